@@ -1141,7 +1141,9 @@ class VGMWriter {
   constructor(module, e) {
     this.module = module;
     this.e = e;
-    this.frames = [];
+    this.writes = [];
+    this.startTicks = 0;
+    this.endTicks = 0;
     this.isEnabled = false;
   }
 
@@ -1150,33 +1152,79 @@ class VGMWriter {
   }
 
   set enabled(set) {
+    if (set) {
+      this.writes = [];
+      this.startTicks = this.module._emulator_get_ticks_f64(this.e);
+    } else {
+      this.onFrame();
+      this.endTicks = this.module._emulator_get_ticks_f64(this.e);
+    }
     this.isEnabled = set;
     this.module._set_log_apu_writes(this.e, set);
   }
 
   onFrame() {
     if (!this.isEnabled) return;
+    if (!this.module._drain_apu_log) {
+      this.onFrameLegacy();
+      return;
+    }
+    // Each ApuWrite is {u64 ticks, u8 addr, u8 value, u8 padding[6]}.
+    const ApuWriteSize = 16;
+    const size = this.module._drain_apu_log(this.e);
+    const buffer = makeWasmBuffer(
+        this.module, this.module._get_apu_log_data_ptr(this.e), size);
+    const dv = new DataView(buffer.buffer, buffer.byteOffset, size);
+    for (let offset = 0; offset < size; offset += ApuWriteSize) {
+      const ticks = dv.getUint32(offset, true) +
+                    dv.getUint32(offset + 4, true) * 0x100000000;
+      this.writes.push({ticks, addr: buffer[offset + 8],
+                        value: buffer[offset + 9]});
+    }
+  }
+
+  // Builds of binjgb.wasm without drain_apu_log only log addr/value pairs, so
+  // time every write in the frame to the end of the frame.
+  onFrameLegacy() {
     const buffer = makeWasmBuffer(
         this.module, this.module._get_apu_log_data_ptr(this.e),
         this.module._get_apu_log_data_size(this.e));
-    const frame = buffer.slice();  // Copy out data.
-    this.frames.push(frame);
+    const ticks = this.module._emulator_get_ticks_f64(this.e);
+    for (let i = 0; i < buffer.length; i += 2) {
+      this.writes.push({ticks, addr: buffer[i], value: buffer[i + 1]});
+    }
     this.module._reset_apu_log(this.e);
   }
 
   write() {
     // The only commands used are:
-    //   $62:       Wait for 1/60th of a second
+    //   $61 nnnn:  Wait n samples
     //   $66:       End of sound data
     //   $B3 aa dd: Write DMG register
     const HeaderSize = 256;
-    let size = HeaderSize + 1; // $66 End of sound data
-    for (let frame of this.frames) {
-      // $B3 count
-      size += (frame.length >>> 1) * 3;
-      // $62 count
-      size += 1;
+    const CpuTicksPerSecond = 4194304;
+    const SamplesPerSecond = 44100;
+    const toSamples = ticks => Math.floor(
+        (Math.max(ticks, this.startTicks) - this.startTicks) *
+        SamplesPerSecond / CpuTicksPerSecond);
+    const stream = [];
+    let samples = 0;
+    const waitUntil = ticks => {
+      const target = toSamples(ticks);
+      while (samples < target) {
+        const wait = Math.min(target - samples, 0xffff);
+        stream.push(0x61, wait & 0xff, wait >>> 8);
+        samples += wait;
+      }
+    };
+    for (let write of this.writes) {
+      waitUntil(write.ticks);
+      stream.push(0xb3, write.addr, write.value);
     }
+    waitUntil(this.endTicks);
+    stream.push(0x66);
+
+    const size = HeaderSize + stream.length;
     const buffer = new ArrayBuffer(size);
     const data = new Uint8Array(buffer);
     const dv = new DataView(buffer);
@@ -1189,23 +1237,14 @@ class VGMWriter {
     dv.setUint32(0x04, size - 4, true);
     // Write version 1.61
     dv.setUint32(0x08, 0x161, true);
-    // Write total # samples (1/60th of a second = 735 samples)
-    dv.setUint32(0x18, this.frames.length * 735, true);
+    // Write total # samples
+    dv.setUint32(0x18, samples, true);
     // Write offset to data stream
     dv.setUint32(0x34, HeaderSize - 0x34, true);
     // Write DMG clock
     dv.setUint32(0x80, 4194304, true);
     // Write data stream
-    let offset = HeaderSize;
-    for (let frame of this.frames) {
-      for (let i = 0; i < frame.length; i += 2) {
-        data[offset++] = 0xb3; // DMG write command.
-        data[offset++] = frame[i];
-        data[offset++] = frame[i + 1];
-      }
-      data[offset++] = 0x62; // Frame wait command.
-    }
-    data[offset++] = 0x66; // End of data stream command.
+    data.set(stream, HeaderSize);
     return buffer;
   }
 }
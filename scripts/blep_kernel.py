@@ -0,0 +1,90 @@
+#!/usr/bin/env python
+#
+# Copyright (C) 2018 Ben Smith
+#
+# This software may be modified and distributed under the terms
+# of the MIT license.  See the LICENSE file for details.
+#
+"""Generate src/blep-kernel.def, the band-limited step table used by the
+emulator's s16/f32 audio output."""
+
+from __future__ import print_function
+import argparse
+import math
+import sys
+
+PHASE_COUNT = 32
+WIDTH = 16
+UNIT = 1 << 15
+CUTOFF = 0.45     # In cycles per output sample; Nyquist is 0.5.
+STEPS = 256       # Integration steps per output sample.
+
+
+def Impulse(t):
+  """Blackman-windowed sinc, zero outside [-WIDTH/2, WIDTH/2]."""
+  half = WIDTH / 2.0
+  if abs(t) >= half:
+    return 0.0
+  x = 2 * CUTOFF * t
+  sinc = 1.0 if x == 0 else math.sin(math.pi * x) / (math.pi * x)
+  w = (t + half) / WIDTH
+  window = (0.42 - 0.5 * math.cos(2 * math.pi * w) +
+            0.08 * math.cos(4 * math.pi * w))
+  return 2 * CUTOFF * sinc * window
+
+
+def StepTable():
+  """Integrate the impulse once; returns S(x) for x on a fine grid."""
+  half = WIDTH // 2
+  dt = 1.0 / STEPS
+  table = [0.0]
+  total = 0.0
+  for i in range(WIDTH * STEPS):
+    t = -half + (i + 0.5) * dt
+    total += Impulse(t) * dt
+    table.append(total)
+  return [v / total for v in table]
+
+
+def Step(table, x):
+  half = WIDTH // 2
+  pos = (x + half) * STEPS
+  if pos <= 0:
+    return 0.0
+  if pos >= len(table) - 1:
+    return 1.0
+  i = int(pos)
+  frac = pos - i
+  return table[i] + (table[i + 1] - table[i]) * frac
+
+
+def main(args):
+  parser = argparse.ArgumentParser()
+  parser.add_argument('-o', '--output', help='output file')
+  options = parser.parse_args(args)
+
+  table = StepTable()
+  out = open(options.output, 'w') if options.output else sys.stdout
+  print('/* Generated by scripts/blep_kernel.py; do not edit. */', file=out)
+  print('/* %d phases x %d taps, each phase sums to %d. */' %
+        (PHASE_COUNT, WIDTH, UNIT), file=out)
+  for phase in range(PHASE_COUNT):
+    frac = phase / float(PHASE_COUNT)
+    # Tap k is the change in the step response over output sample k, for a
+    # step at |frac| samples after tap WIDTH/2 - 1. The last tap takes the
+    # residual so each phase sums exactly to UNIT.
+    prev = 0
+    taps = []
+    for k in range(WIDTH):
+      if k == WIDTH - 1:
+        cur = UNIT
+      else:
+        cur = int(round(Step(table, k - frac - (WIDTH // 2 - 1)) * UNIT))
+      taps.append(cur - prev)
+      prev = cur
+    print('{%s},' % ', '.join('%d' % t for t in taps), file=out)
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,669 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "emulator.h"
+#include "manifest.h"
+#include "options.h"
+
+/* Runs many ROMs in a single process, one Emulator instance per test, spread
+ * across a pool of worker threads. Each worker owns a deque of tests; it pops
+ * from the bottom of its own deque, and when that runs dry it steals from the
+ * top of another worker's deque.
+ *
+ * The manifest has the same format as scripts/test.json (see manifest.h), so
+ * the expected hashes can be shared with scripts/tester.py. */
+
+#define AUDIO_FREQUENCY 44100
+#define AUDIO_FRAMES ((AUDIO_FREQUENCY / 10) * SOUND_OUTPUT_COUNT)
+#define MAX_THREADS 256
+#define SHA1_HEX_SIZE 41 /* Including \0. */
+
+#define OK_STRING      "[OK] "
+#define FAIL_STRING    "[X]  "
+#define UNKNOWN_STRING "[?]  "
+
+typedef enum {
+  TEST_STATUS_PASSED,
+  TEST_STATUS_FAILED,
+  TEST_STATUS_EXPECTED_FAIL,
+  TEST_STATUS_UNKNOWN,
+  TEST_STATUS_ERROR,
+} TestStatus;
+
+typedef struct {
+  char* suite;
+  char* rom;
+  int frames;
+  char* hash;
+
+  /* Results, written by the worker that ran the test. */
+  TestStatus status;
+  char actual_hash[SHA1_HEX_SIZE];
+  Ticks ticks;
+  f64 host_time;
+} Test;
+
+typedef struct {
+  Test* tests;
+  size_t count;
+  size_t capacity;
+} TestList;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  int* jobs; /* Indexes into TestList. */
+  int top;    /* Thieves take from here. */
+  int bottom; /* The owner pushes and pops here. */
+} WorkDeque;
+
+typedef struct {
+  pthread_t thread;
+  int index;
+  int tests_run;
+  int tests_stolen;
+} Worker;
+
+typedef struct {
+  u32 state[5];
+  u64 length;
+  u8 block[64];
+  u32 block_size;
+} Sha1;
+
+static const char* s_manifest_filename;
+static const char* s_root_dir;
+static const char* s_filter;
+static int s_thread_count;
+static u32 s_random_seed = 0xcabba6e5;
+static int s_verbose;
+
+static TestList s_tests;
+static WorkDeque s_deques[MAX_THREADS];
+static Worker s_workers[MAX_THREADS];
+
+static f64 get_time_sec(void) {
+  struct timeval tp;
+  gettimeofday(&tp, NULL);
+  return (f64)tp.tv_sec + (f64)tp.tv_usec / 1000000.0;
+}
+
+static u32 sha1_rol(u32 x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_init(Sha1* sha1) {
+  static const u32 s_initial[5] = {0x67452301, 0xefcdab89, 0x98badcfe,
+                                   0x10325476, 0xc3d2e1f0};
+  memcpy(sha1->state, s_initial, sizeof(s_initial));
+  sha1->length = 0;
+  sha1->block_size = 0;
+}
+
+static void sha1_transform(Sha1* sha1) {
+  u32 w[80];
+  int i;
+  for (i = 0; i < 16; ++i) {
+    const u8* p = sha1->block + i * 4;
+    w[i] = ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | p[3];
+  }
+  for (i = 16; i < 80; ++i) {
+    w[i] = sha1_rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  u32 a = sha1->state[0], b = sha1->state[1], c = sha1->state[2],
+      d = sha1->state[3], e = sha1->state[4];
+  for (i = 0; i < 80; ++i) {
+    u32 f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    u32 temp = sha1_rol(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = sha1_rol(b, 30);
+    b = a;
+    a = temp;
+  }
+  sha1->state[0] += a;
+  sha1->state[1] += b;
+  sha1->state[2] += c;
+  sha1->state[3] += d;
+  sha1->state[4] += e;
+}
+
+static void sha1_update(Sha1* sha1, const void* data, size_t size) {
+  const u8* src = data;
+  sha1->length += size;
+  while (size > 0) {
+    u32 n = MIN(size, sizeof(sha1->block) - sha1->block_size);
+    memcpy(sha1->block + sha1->block_size, src, n);
+    sha1->block_size += n;
+    src += n;
+    size -= n;
+    if (sha1->block_size == sizeof(sha1->block)) {
+      sha1_transform(sha1);
+      sha1->block_size = 0;
+    }
+  }
+}
+
+static void sha1_final(Sha1* sha1, char out_hex[SHA1_HEX_SIZE]) {
+  u64 bit_length = sha1->length * 8;
+  static const u8 s_pad = 0x80;
+  static const u8 s_zero = 0;
+  sha1_update(sha1, &s_pad, 1);
+  while (sha1->block_size != 56) {
+    sha1_update(sha1, &s_zero, 1);
+  }
+  u8 length_bytes[8];
+  int i;
+  for (i = 0; i < 8; ++i) {
+    length_bytes[i] = (u8)(bit_length >> (56 - i * 8));
+  }
+  sha1_update(sha1, length_bytes, sizeof(length_bytes));
+  assert(sha1->block_size == 0);
+  for (i = 0; i < 5; ++i) {
+    snprintf(out_hex + i * 8, 9, "%08x", sha1->state[i]);
+  }
+}
+
+/* Hashes the frame buffer exactly as tester.c's write_frame_ppm would write
+ * it, without touching the filesystem. */
+static void hash_frame_ppm(Emulator* e, char out_hex[SHA1_HEX_SIZE]) {
+  Sha1 sha1;
+  sha1_init(&sha1);
+  char line[SCREEN_WIDTH * 12 + 2];
+  int len = snprintf(line, sizeof(line), "P3\n%u %u\n255\n", SCREEN_WIDTH,
+                     SCREEN_HEIGHT);
+  sha1_update(&sha1, line, len);
+
+  RGBA* data = *emulator_get_frame_buffer(e);
+  int x, y;
+  for (y = 0; y < SCREEN_HEIGHT; ++y) {
+    char* p = line;
+    for (x = 0; x < SCREEN_WIDTH; ++x) {
+      RGBA pixel = *data++;
+      u8 b = (pixel >> 16) & 0xff;
+      u8 g = (pixel >> 8) & 0xff;
+      u8 r = (pixel >> 0) & 0xff;
+      p += sprintf(p, "%3u %3u %3u ", r, g, b);
+    }
+    *p++ = '\n';
+    sha1_update(&sha1, line, p - line);
+  }
+  sha1_final(&sha1, out_hex);
+}
+
+static Result test_list_append(TestList* list, const Test* test) {
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 64;
+    Test* tests = xrealloc(list->tests, capacity * sizeof(Test));
+    CHECK_MSG(tests != NULL, "Test list allocation failed.\n");
+    list->tests = tests;
+    list->capacity = capacity;
+  }
+  list->tests[list->count++] = *test;
+  return OK;
+  ON_ERROR_RETURN;
+}
+
+static void test_list_delete(TestList* list) {
+  size_t i;
+  for (i = 0; i < list->count; ++i) {
+    xfree(list->tests[i].suite);
+    xfree(list->tests[i].rom);
+    xfree(list->tests[i].hash);
+  }
+  xfree(list->tests);
+  ZERO_MEMORY(*list);
+}
+
+static Result read_manifest(const char* filename, TestList* out_list) {
+  Manifest manifest;
+  ZERO_MEMORY(manifest);
+  CHECK(SUCCESS(manifest_read(filename, &manifest)));
+  size_t i;
+  for (i = 0; i < manifest.count; ++i) {
+    ManifestEntry* entry = &manifest.entries[i];
+    if (!s_filter || strstr(entry->rom, s_filter)) {
+      /* The test takes ownership of the entry's strings. */
+      Test test;
+      ZERO_MEMORY(test);
+      test.suite = entry->suite;
+      test.rom = entry->rom;
+      test.frames = entry->frames;
+      test.hash = entry->hash;
+      CHECK(SUCCESS(test_list_append(out_list, &test)));
+      ZERO_MEMORY(*entry);
+    }
+  }
+  manifest_delete(&manifest);
+  return OK;
+error:
+  manifest_delete(&manifest);
+  return ERROR;
+}
+
+static Result run_frames(Emulator* e, Ticks until_ticks) {
+  Bool finish_at_next_frame = FALSE;
+  while (TRUE) {
+    EmulatorEvent event = emulator_run_until(e, until_ticks);
+    if (event & EMULATOR_EVENT_NEW_FRAME) {
+      if (finish_at_next_frame) {
+        break;
+      }
+    }
+    if (event & EMULATOR_EVENT_UNTIL_TICKS) {
+      finish_at_next_frame = TRUE;
+      until_ticks += PPU_FRAME_TICKS;
+    }
+    if (event & EMULATOR_EVENT_INVALID_OPCODE) {
+      return ERROR;
+    }
+  }
+  return OK;
+}
+
+static void set_skip_render(Emulator* e, Bool skip_render) {
+  EmulatorConfig emulator_config = emulator_get_config(e);
+  emulator_config.skip_render = skip_render;
+  emulator_set_config(e, &emulator_config);
+}
+
+/* Only the last frame is hashed, so all but the last frame are run without
+ * rendering. If the ROM hits an invalid opcode before then, the frame on
+ * screen was never rendered, so run again from the start with rendering. */
+static Result run_emulator(Emulator* e, int frames) {
+  Ticks until_ticks = emulator_get_ticks(e) + (Ticks)frames * PPU_FRAME_TICKS;
+  if (frames < 2) {
+    return run_frames(e, until_ticks);
+  }
+
+  FileData initial_state;
+  emulator_init_state_file_data(&initial_state);
+  CHECK(SUCCESS(emulator_write_state(e, &initial_state)));
+  set_skip_render(e, TRUE);
+  EmulatorEvent event;
+  do {
+    event = emulator_run_until(e, until_ticks - PPU_FRAME_TICKS);
+  } while (!(event & (EMULATOR_EVENT_UNTIL_TICKS |
+                      EMULATOR_EVENT_INVALID_OPCODE)));
+  set_skip_render(e, FALSE);
+  if (event & EMULATOR_EVENT_INVALID_OPCODE) {
+    CHECK(SUCCESS(emulator_read_state(e, &initial_state)));
+  }
+  file_data_delete(&initial_state);
+  return run_frames(e, until_ticks);
+error:
+  file_data_delete(&initial_state);
+  return ERROR;
+}
+
+static void run_test(Test* test) {
+  Emulator* e = NULL;
+  FileData rom;
+  ZERO_MEMORY(rom);
+  f64 start_time = get_time_sec();
+
+  const char* rom_filename = test->rom;
+  char path[1024];
+  if (s_root_dir && rom_filename[0] != '/') {
+    snprintf(path, sizeof(path), "%s/%s", s_root_dir, rom_filename);
+    rom_filename = path;
+  }
+
+  test->status = TEST_STATUS_ERROR;
+  CHECK(SUCCESS(file_map_aligned(rom_filename, MINIMUM_ROM_SIZE, &rom)));
+
+  EmulatorInit emulator_init;
+  ZERO_MEMORY(emulator_init);
+  emulator_init.rom = rom;
+  emulator_init.audio_frequency = AUDIO_FREQUENCY;
+  emulator_init.audio_frames = AUDIO_FRAMES;
+  emulator_init.random_seed = s_random_seed;
+  e = emulator_new(&emulator_init);
+  CHECK(e != NULL);
+
+  /* Only the frame buffer is checked, so don't bother generating audio. */
+  EmulatorConfig emulator_config = emulator_get_config(e);
+  emulator_config.disable_audio = TRUE;
+  emulator_set_config(e, &emulator_config);
+
+  /* Hash whatever is on screen even if the ROM hits an invalid opcode, same
+   * as binjgb-tester. */
+  run_emulator(e, test->frames);
+  hash_frame_ppm(e, test->actual_hash);
+  test->ticks = emulator_get_ticks(e);
+
+  const char* expected = test->hash;
+  Bool expect_fail = expected[0] == '!';
+  if (expect_fail) {
+    expected++;
+  }
+  if (strcmp(test->actual_hash, expected) == 0) {
+    test->status =
+        expect_fail ? TEST_STATUS_EXPECTED_FAIL : TEST_STATUS_PASSED;
+  } else if (expected[0] == 0 || expect_fail) {
+    test->status = TEST_STATUS_UNKNOWN;
+  } else {
+    test->status = TEST_STATUS_FAILED;
+  }
+
+error:
+  if (e) {
+    emulator_delete(e);
+  }
+  file_data_unmap(&rom);
+  test->host_time = get_time_sec() - start_time;
+}
+
+static Bool deque_pop_bottom(WorkDeque* deque, int* out_job) {
+  Bool result = FALSE;
+  pthread_mutex_lock(&deque->mutex);
+  if (deque->top < deque->bottom) {
+    *out_job = deque->jobs[--deque->bottom];
+    result = TRUE;
+  }
+  pthread_mutex_unlock(&deque->mutex);
+  return result;
+}
+
+static Bool deque_steal_top(WorkDeque* deque, int* out_job) {
+  Bool result = FALSE;
+  pthread_mutex_lock(&deque->mutex);
+  if (deque->top < deque->bottom) {
+    *out_job = deque->jobs[deque->top++];
+    result = TRUE;
+  }
+  pthread_mutex_unlock(&deque->mutex);
+  return result;
+}
+
+static void* worker_main(void* user_data) {
+  Worker* worker = user_data;
+  while (TRUE) {
+    int job;
+    if (!deque_pop_bottom(&s_deques[worker->index], &job)) {
+      /* No jobs are ever added once the workers start, so if every deque is
+       * empty this worker is done. */
+      Bool stole = FALSE;
+      int i;
+      for (i = 1; i < s_thread_count && !stole; ++i) {
+        int victim = (worker->index + i) % s_thread_count;
+        stole = deque_steal_top(&s_deques[victim], &job);
+      }
+      if (!stole) {
+        break;
+      }
+      worker->tests_stolen++;
+    }
+    run_test(&s_tests.tests[job]);
+    worker->tests_run++;
+  }
+  return NULL;
+}
+
+static int compare_test_frames_desc(const void* a, const void* b) {
+  int ia = *(const int*)a, ib = *(const int*)b;
+  int dframes = s_tests.tests[ib].frames - s_tests.tests[ia].frames;
+  return dframes != 0 ? dframes : ia - ib;
+}
+
+static void distribute_jobs(void) {
+  /* Deal the longest tests out first, round-robin, so each worker starts on a
+   * long test and the short tests at the top of each deque are what get
+   * stolen at the end. */
+  int count = (int)s_tests.count;
+  int* order = xmalloc(count * sizeof(int));
+  int i;
+  for (i = 0; i < count; ++i) {
+    order[i] = i;
+  }
+  qsort(order, count, sizeof(int), compare_test_frames_desc);
+
+  for (i = 0; i < s_thread_count; ++i) {
+    WorkDeque* deque = &s_deques[i];
+    pthread_mutex_init(&deque->mutex, NULL);
+    deque->jobs = xmalloc((count / s_thread_count + 1) * sizeof(int));
+    deque->top = deque->bottom = 0;
+  }
+
+  /* The owner pops from the bottom, so push in reverse to make the longest
+   * tests come out first. */
+  for (i = count - 1; i >= 0; --i) {
+    WorkDeque* deque = &s_deques[i % s_thread_count];
+    deque->jobs[deque->bottom++] = order[i];
+  }
+  xfree(order);
+}
+
+static void print_results(f64 wall_time) {
+  int passed = 0, expected_failed = 0, failed = 0, errors = 0;
+  Ticks total_ticks = 0;
+  f64 total_host_time = 0;
+  size_t i;
+  for (i = 0; i < s_tests.count; ++i) {
+    Test* test = &s_tests.tests[i];
+    total_ticks += test->ticks;
+    total_host_time += test->host_time;
+    f64 gb_time = (f64)test->ticks / CPU_TICKS_PER_SECOND;
+    switch (test->status) {
+      case TEST_STATUS_PASSED:
+        passed++;
+        if (s_verbose > 1) {
+          printf(OK_STRING "%s", test->rom);
+        }
+        break;
+      case TEST_STATUS_EXPECTED_FAIL:
+        expected_failed++;
+        if (s_verbose > 0) {
+          printf(FAIL_STRING "%s", test->rom);
+        }
+        break;
+      case TEST_STATUS_UNKNOWN:
+        failed++;
+        printf(UNKNOWN_STRING "%s => %s", test->rom, test->actual_hash);
+        break;
+      case TEST_STATUS_FAILED:
+        failed++;
+        printf(FAIL_STRING "%s => %s", test->rom, test->actual_hash);
+        break;
+      case TEST_STATUS_ERROR:
+        errors++;
+        printf(FAIL_STRING "%s => error", test->rom);
+        break;
+    }
+    Bool printed = test->status != TEST_STATUS_PASSED || s_verbose > 1;
+    printed &= test->status != TEST_STATUS_EXPECTED_FAIL || s_verbose > 0;
+    if (printed) {
+      if (s_verbose > 0 && test->host_time > 0) {
+        printf(" (gb=%.1fs host=%.2fs %.1fx)", gb_time, test->host_time,
+               gb_time / test->host_time);
+      }
+      printf("\n");
+    }
+  }
+
+  if (s_verbose > 0) {
+    int t;
+    for (t = 0; t < s_thread_count; ++t) {
+      printf("worker %d: ran %d tests (%d stolen)\n", t,
+             s_workers[t].tests_run, s_workers[t].tests_stolen);
+    }
+  }
+
+  f64 total_gb_time = (f64)total_ticks / CPU_TICKS_PER_SECOND;
+  f64 total_frames = (f64)total_ticks / PPU_FRAME_TICKS;
+  printf("passed %d/%d (%d failed, %d expected failures, %d errors)\n",
+         passed, (int)s_tests.count, failed, expected_failed, errors);
+  printf("time: gb=%.1fs host=%.1fs wall=%.1fs threads=%d\n", total_gb_time,
+         total_host_time, wall_time, s_thread_count);
+  if (wall_time > 0) {
+    printf("throughput: %.1fx realtime, %.0f frames/s\n",
+           total_gb_time / wall_time, total_frames / wall_time);
+  }
+}
+
+static void usage(int argc, char** argv) {
+  static const char usage[] =
+      "usage: %s [options] <test.json>\n"
+      "  -h,--help            help\n"
+      "  -j,--threads N       number of worker threads (default: #cpus)\n"
+      "  -r,--root DIR        directory ROM paths are relative to\n"
+      "  -f,--filter STR      only run tests whose ROM path contains STR\n"
+      "  -s,--seed SEED       random seed used for initializing RAM\n"
+      "  -v,--verbose         increase verbosity\n";
+
+  PRINT_ERROR(usage, argv[0]);
+}
+
+static void parse_options(int argc, char** argv) {
+  static const Option options[] = {
+    {'h', "help", 0},
+    {'j', "threads", 1},
+    {'r', "root", 1},
+    {'f', "filter", 1},
+    {'s', "seed", 1},
+    {'v', "verbose", 0},
+  };
+
+  struct OptionParser* parser = option_parser_new(
+      options, sizeof(options) / sizeof(options[0]), argc, argv);
+
+  int done = 0;
+  while (!done) {
+    OptionResult result = option_parser_next(parser);
+    switch (result.kind) {
+      case OPTION_RESULT_KIND_UNKNOWN:
+        PRINT_ERROR("ERROR: Unknown option: %s.\n\n", result.arg);
+        goto error;
+
+      case OPTION_RESULT_KIND_EXPECTED_VALUE:
+        PRINT_ERROR("ERROR: Option --%s requires a value.\n\n",
+                    result.option->long_name);
+        goto error;
+
+      case OPTION_RESULT_KIND_BAD_SHORT_OPTION:
+        PRINT_ERROR("ERROR: Short option -%c is too long: %s.\n\n",
+                    result.option->short_name, result.arg);
+        goto error;
+
+      case OPTION_RESULT_KIND_OPTION:
+        switch (result.option->short_name) {
+          case 'h':
+            goto error;
+
+          case 'j':
+            s_thread_count = atoi(result.value);
+            break;
+
+          case 'r':
+            s_root_dir = result.value;
+            break;
+
+          case 'f':
+            s_filter = result.value;
+            break;
+
+          case 's':
+            s_random_seed = atoi(result.value);
+            break;
+
+          case 'v':
+            s_verbose++;
+            break;
+
+          default:
+            abort();
+        }
+        break;
+
+      case OPTION_RESULT_KIND_ARG:
+        s_manifest_filename = result.value;
+        break;
+
+      case OPTION_RESULT_KIND_DONE:
+        done = 1;
+        break;
+    }
+  }
+
+  if (!s_manifest_filename) {
+    PRINT_ERROR("ERROR: expected input .json\n\n");
+    goto error;
+  }
+
+  option_parser_delete(parser);
+  return;
+
+error:
+  usage(argc, argv);
+  option_parser_delete(parser);
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  int result = 1;
+  parse_options(argc, argv);
+
+  if (s_thread_count <= 0) {
+    s_thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  s_thread_count = CLAMP(s_thread_count, 1, MAX_THREADS);
+
+  CHECK(SUCCESS(read_manifest(s_manifest_filename, &s_tests)));
+  if (s_tests.count == 0) {
+    printf("no tests.\n");
+    result = 0;
+    goto error;
+  }
+  s_thread_count = MIN(s_thread_count, (int)s_tests.count);
+  distribute_jobs();
+
+  f64 start_time = get_time_sec();
+  int i;
+  for (i = 0; i < s_thread_count; ++i) {
+    s_workers[i].index = i;
+    CHECK_MSG(pthread_create(&s_workers[i].thread, NULL, worker_main,
+                             &s_workers[i]) == 0,
+              "pthread_create failed.\n");
+  }
+  for (i = 0; i < s_thread_count; ++i) {
+    pthread_join(s_workers[i].thread, NULL);
+  }
+  f64 wall_time = get_time_sec() - start_time;
+
+  print_results(wall_time);
+
+  result = 0;
+  size_t t;
+  for (t = 0; t < s_tests.count; ++t) {
+    TestStatus status = s_tests.tests[t].status;
+    if (status != TEST_STATUS_PASSED && status != TEST_STATUS_EXPECTED_FAIL) {
+      result = 1;
+    }
+  }
+
+  for (i = 0; i < s_thread_count; ++i) {
+    pthread_mutex_destroy(&s_deques[i].mutex);
+    xfree(s_deques[i].jobs);
+  }
+error:
+  test_list_delete(&s_tests);
+  return result;
+}
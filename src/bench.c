@@ -0,0 +1,540 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulator.h"
+#include "manifest.h"
+#include "options.h"
+
+/* After common.h: windows.h redefines TRUE and FALSE. */
+#ifdef _MSC_VER
+#define WIN32_LEAN_AND_MEAN
+#define NOGDI
+#include <windows.h>
+#undef ERROR
+#else
+#include <sys/time.h>
+#endif
+
+/* Measures emulation speed, so regressions can be tracked from commit to
+ * commit. Every ROM in the selected suites of a test manifest (see
+ * manifest.h) is run for a fixed number of frames, ignoring the manifest's
+ * frame count, from the same power-on state each time. After some warmup
+ * runs, the host time of each repetition is recorded and summarized by its
+ * median and percentiles.
+ *
+ * Each ROM is run in several passes: everything enabled, without audio
+ * synthesis, and without rendering. The difference from the full pass is
+ * the time spent in that subsystem; what's left is CPU, timers, DMA and the
+ * rest of the PPU. If the emulator is built with BINJGB_PROFILE, the time
+ * spent in each subsystem during the full pass is reported too. */
+
+#define AUDIO_FREQUENCY 44100
+#define AUDIO_FRAMES ((AUDIO_FREQUENCY / 10) * SOUND_OUTPUT_COUNT)
+#define MAX_REPETITIONS 1000
+#define MAX_SUITES 16
+
+typedef enum {
+  BENCH_PASS_FULL,
+  BENCH_PASS_NO_AUDIO,
+  BENCH_PASS_NO_RENDER,
+  BENCH_PASS_COUNT,
+} BenchPass;
+
+static const char* s_pass_names[BENCH_PASS_COUNT] = {"full", "no_audio",
+                                                     "no_render"};
+
+typedef struct {
+  f64 min_sec;
+  f64 median_sec;
+  f64 p10_sec;
+  f64 p90_sec;
+} BenchStats;
+
+typedef struct {
+  const ManifestEntry* entry;
+  Bool ran;
+  Ticks ticks; /* Emulated by each repetition. */
+  BenchStats pass[BENCH_PASS_COUNT];
+  EmulatorProfile profile; /* Summed over the timed runs of the full pass. */
+} BenchResult;
+
+static const char* s_manifest_filename = "scripts/test.json";
+static const char* s_root_dir;
+static const char* s_filter;
+static const char* s_json_filename;
+static const char* s_suites[MAX_SUITES];
+static int s_suite_count;
+static int s_frames = 300;
+static int s_warmup = 1;
+static int s_repetitions = 5;
+static u32 s_random_seed = 0xcabba6e5;
+/* binjgb's default, so the audio share matches what players see. */
+static AudioFormat s_audio_format = AUDIO_FORMAT_F32;
+
+static const char* s_audio_format_names[AUDIO_FORMAT_COUNT] = {"u8", "s16",
+                                                               "f32"};
+
+/* The ROMs in scripts/test.json that aren't in a suite, e.g.
+ * test/oam_count_v5.gb, have an empty suite name. */
+static const char* s_default_suites[] = {"blargg", "mooneye", ""};
+
+static f64 get_time_sec(void) {
+#ifdef _MSC_VER
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (f64)counter.QuadPart / (f64)frequency.QuadPart;
+#else
+  struct timeval tp;
+  gettimeofday(&tp, NULL);
+  return (f64)tp.tv_sec + (f64)tp.tv_usec / 1000000.0;
+#endif
+}
+
+static Bool is_selected(const ManifestEntry* entry) {
+  if (s_filter && !strstr(entry->rom, s_filter)) {
+    return FALSE;
+  }
+  int i;
+  for (i = 0; i < s_suite_count; ++i) {
+    if (strcmp(entry->suite, s_suites[i]) == 0) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static int compare_f64(const void* a, const void* b) {
+  f64 fa = *(const f64*)a, fb = *(const f64*)b;
+  return fa < fb ? -1 : fa > fb ? 1 : 0;
+}
+
+/* Linearly interpolates between the closest ranks of |sorted|. */
+static f64 percentile(const f64* sorted, int count, f64 p) {
+  f64 rank = p * (count - 1);
+  int lo = (int)rank;
+  int hi = MIN(lo + 1, count - 1);
+  return sorted[lo] + (sorted[hi] - sorted[lo]) * (rank - lo);
+}
+
+static BenchStats get_stats(f64* samples, int count) {
+  BenchStats stats;
+  qsort(samples, count, sizeof(f64), compare_f64);
+  stats.min_sec = samples[0];
+  stats.median_sec = percentile(samples, count, 0.5);
+  stats.p10_sec = percentile(samples, count, 0.1);
+  stats.p90_sec = percentile(samples, count, 0.9);
+  return stats;
+}
+
+static void set_pass(Emulator* e, BenchPass pass) {
+  EmulatorConfig emulator_config = emulator_get_config(e);
+  emulator_config.disable_audio = pass == BENCH_PASS_NO_AUDIO;
+  emulator_config.skip_render = pass == BENCH_PASS_NO_RENDER;
+  emulator_set_config(e, &emulator_config);
+}
+
+/* Runs s_frames frames, or until the ROM hits an invalid opcode. The audio
+ * buffer is ignored, but is still filled. */
+static Ticks run_frames(Emulator* e) {
+  Ticks start_ticks = emulator_get_ticks(e);
+  Ticks until_ticks = start_ticks + (Ticks)s_frames * PPU_FRAME_TICKS;
+  EmulatorEvent event;
+  do {
+    event = emulator_run_until(e, until_ticks);
+  } while (!(event & (EMULATOR_EVENT_UNTIL_TICKS |
+                      EMULATOR_EVENT_INVALID_OPCODE)));
+  return emulator_get_ticks(e) - start_ticks;
+}
+
+static void bench_rom(BenchResult* result) {
+  Emulator* e = NULL;
+  EmulatorRom* shared_rom = NULL;
+  FileData rom, initial_state;
+  ZERO_MEMORY(rom);
+  ZERO_MEMORY(initial_state);
+
+  const char* rom_filename = result->entry->rom;
+  char path[1024];
+  if (s_root_dir && rom_filename[0] != '/') {
+    snprintf(path, sizeof(path), "%s/%s", s_root_dir, rom_filename);
+    rom_filename = path;
+  }
+
+  CHECK(SUCCESS(file_map_aligned(rom_filename, MINIMUM_ROM_SIZE, &rom)));
+  /* The emulator keeps the image, and with it the mapping, alive. */
+  shared_rom = emulator_rom_new(&rom, file_data_unmap);
+  CHECK(shared_rom != NULL);
+  ZERO_MEMORY(rom);
+
+  EmulatorInit emulator_init;
+  ZERO_MEMORY(emulator_init);
+  emulator_init.shared_rom = shared_rom;
+  emulator_init.audio_frequency = AUDIO_FREQUENCY;
+  emulator_init.audio_frames = AUDIO_FRAMES;
+  emulator_init.audio_format = s_audio_format;
+  emulator_init.random_seed = s_random_seed;
+  e = emulator_new(&emulator_init);
+  emulator_rom_release(shared_rom);
+  CHECK(e != NULL);
+
+  emulator_init_state_file_data(&initial_state);
+  CHECK(SUCCESS(emulator_write_state(e, &initial_state)));
+
+  f64 samples[MAX_REPETITIONS];
+  int pass;
+  for (pass = 0; pass < BENCH_PASS_COUNT; ++pass) {
+    set_pass(e, pass);
+    int i;
+    for (i = -s_warmup; i < s_repetitions; ++i) {
+      CHECK(SUCCESS(emulator_read_state(e, &initial_state)));
+      if (i == 0) {
+        emulator_reset_profile(e);
+      }
+      f64 start_time = get_time_sec();
+      Ticks ticks = run_frames(e);
+      f64 host_time = get_time_sec() - start_time;
+      if (i >= 0) {
+        samples[i] = host_time;
+      }
+      /* All passes must run the same code, so only the time differs. */
+      if (pass == BENCH_PASS_FULL) {
+        result->ticks = ticks;
+      } else {
+        CHECK_MSG(ticks == result->ticks,
+                  "%s: pass %s ran %" PRIu64 " ticks, expected %" PRIu64
+                  ".\n",
+                  rom_filename, s_pass_names[pass], ticks, result->ticks);
+      }
+    }
+    result->pass[pass] = get_stats(samples, s_repetitions);
+    if (pass == BENCH_PASS_FULL) {
+      result->profile = emulator_get_profile(e);
+    }
+  }
+  result->ran = TRUE;
+
+error:
+  file_data_delete(&initial_state);
+  if (e) {
+    emulator_delete(e);
+  }
+  file_data_unmap(&rom);
+}
+
+static f64 get_fraction(const BenchResult* result, BenchPass pass) {
+  f64 full_sec = result->pass[BENCH_PASS_FULL].median_sec;
+  f64 saved_sec = full_sec - result->pass[pass].median_sec;
+  return full_sec > 0 ? MAX(saved_sec, 0) / full_sec : 0;
+}
+
+static void print_profile(const EmulatorProfile* profile) {
+  u64 total_clocks = 0;
+  int kind;
+  for (kind = 0; kind < EMULATOR_PROFILE_COUNT; ++kind) {
+    total_clocks += profile->clocks[kind];
+  }
+  printf("  ");
+  for (kind = 0; kind < EMULATOR_PROFILE_COUNT; ++kind) {
+    printf(" %s %.1f%%", emulator_get_profile_kind_name(kind),
+           total_clocks ? profile->clocks[kind] * 100.0 / total_clocks : 0);
+  }
+  printf("\n");
+}
+
+static void print_results(const BenchResult* results, size_t count) {
+  printf("%-52s %9s %9s %9s %9s %6s %6s\n", "rom", "median", "p10", "p90",
+         "fps", "audio", "render");
+  Ticks total_ticks = 0;
+  f64 total_sec = 0;
+  int ran = 0;
+  size_t i;
+  for (i = 0; i < count; ++i) {
+    const BenchResult* result = &results[i];
+    if (!result->ran) {
+      continue;
+    }
+    const BenchStats* full = &result->pass[BENCH_PASS_FULL];
+    f64 frames = (f64)result->ticks / PPU_FRAME_TICKS;
+    printf("%-52s %8.4fs %8.4fs %8.4fs %9.0f %5.1f%% %5.1f%%\n",
+           result->entry->rom, full->median_sec, full->p10_sec,
+           full->p90_sec, frames / full->median_sec,
+           get_fraction(result, BENCH_PASS_NO_AUDIO) * 100,
+           get_fraction(result, BENCH_PASS_NO_RENDER) * 100);
+    if (result->profile.enabled) {
+      print_profile(&result->profile);
+    }
+    total_ticks += result->ticks;
+    total_sec += full->median_sec;
+    ran++;
+  }
+
+  if (total_sec > 0) {
+    f64 gb_time = (f64)total_ticks / CPU_TICKS_PER_SECOND;
+    printf("total: %d roms, %.0f frames/s, %.2f Mticks/s (%.1fx realtime)\n",
+           ran, (f64)total_ticks / PPU_FRAME_TICKS / total_sec,
+           (f64)total_ticks / total_sec / 1e6, gb_time / total_sec);
+  }
+}
+
+static void write_stats_json(FILE* f, const char* name,
+                             const BenchStats* stats) {
+  fprintf(f,
+          "\"%s\": {\"min_sec\": %.6f, \"median_sec\": %.6f, "
+          "\"p10_sec\": %.6f, \"p90_sec\": %.6f}",
+          name, stats->min_sec, stats->median_sec, stats->p10_sec,
+          stats->p90_sec);
+}
+
+/* The manifest reader doesn't allow escapes, so the strings can be written
+ * as-is. */
+static Result write_json(const char* filename, const BenchResult* results,
+                         size_t count) {
+  FILE* f = fopen(filename, "w");
+  CHECK_MSG(f != NULL, "unable to open file \"%s\".\n", filename);
+  fprintf(f, "{\n  \"frames\": %d,\n  \"warmup\": %d,\n"
+             "  \"repetitions\": %d,\n  \"audio_format\": \"%s\",\n"
+             "  \"roms\": [",
+          s_frames, s_warmup, s_repetitions,
+          s_audio_format_names[s_audio_format]);
+  Ticks total_ticks = 0;
+  f64 total_sec = 0;
+  const char* sep = "\n";
+  size_t i;
+  for (i = 0; i < count; ++i) {
+    const BenchResult* result = &results[i];
+    if (!result->ran) {
+      continue;
+    }
+    f64 median_sec = result->pass[BENCH_PASS_FULL].median_sec;
+    fprintf(f,
+            "%s    {\"suite\": \"%s\", \"rom\": \"%s\", \"ticks\": %" PRIu64
+            ", \"fps\": %.1f, \"ticks_per_sec\": %.0f",
+            sep, result->entry->suite, result->entry->rom, result->ticks,
+            (f64)result->ticks / PPU_FRAME_TICKS / median_sec,
+            (f64)result->ticks / median_sec);
+    int pass;
+    for (pass = 0; pass < BENCH_PASS_COUNT; ++pass) {
+      fprintf(f, ", ");
+      write_stats_json(f, s_pass_names[pass], &result->pass[pass]);
+    }
+    if (result->profile.enabled) {
+      fprintf(f, ", \"profile\": {\"clock_unit\": \"%s\"",
+              result->profile.clock_unit);
+      int kind;
+      for (kind = 0; kind < EMULATOR_PROFILE_COUNT; ++kind) {
+        fprintf(f, ", \"%s\": {\"clocks\": %" PRIu64 ", \"calls\": %" PRIu64
+                   "}",
+                emulator_get_profile_kind_name(kind),
+                result->profile.clocks[kind], result->profile.calls[kind]);
+      }
+      fprintf(f, "}");
+    }
+    fprintf(f, "}");
+    sep = ",\n";
+    total_ticks += result->ticks;
+    total_sec += median_sec;
+  }
+  fprintf(f,
+          "\n  ],\n  \"total\": {\"ticks\": %" PRIu64
+          ", \"median_sec\": %.6f, \"fps\": %.1f, \"ticks_per_sec\": %.0f}\n"
+          "}\n",
+          total_ticks, total_sec,
+          total_sec > 0 ? (f64)total_ticks / PPU_FRAME_TICKS / total_sec : 0,
+          total_sec > 0 ? (f64)total_ticks / total_sec : 0);
+  fclose(f);
+  return OK;
+  ON_ERROR_RETURN;
+}
+
+static void usage(int argc, char** argv) {
+  static const char usage[] =
+      "usage: %s [options] [test.json]\n"
+      "  -h,--help            help\n"
+      "  -f,--frames N        frames to run each ROM (default 300)\n"
+      "  -w,--warmup N        untimed runs before measuring (default 1)\n"
+      "  -n,--repetitions N   timed runs of each pass (default 5)\n"
+      "  -S,--suite NAME      benchmark this suite; may be repeated\n"
+      "                       (default blargg, mooneye and the ROMs that\n"
+      "                       aren't in a suite)\n"
+      "  -F,--filter STR      only run ROMs whose path contains STR\n"
+      "  -r,--root DIR        directory ROM paths are relative to\n"
+      "  -o,--json FILE       write results as JSON to FILE\n"
+      "  -s,--seed SEED       random seed used for initializing RAM\n"
+      "  -a,--audio-format F  audio format: u8, s16 or f32 (default f32)\n"
+      "\n"
+      "The manifest defaults to scripts/test.json.\n";
+
+  PRINT_ERROR(usage, argv[0]);
+}
+
+static void parse_options(int argc, char** argv) {
+  static const Option options[] = {
+    {'h', "help", 0},
+    {'f', "frames", 1},
+    {'w', "warmup", 1},
+    {'n', "repetitions", 1},
+    {'S', "suite", 1},
+    {'F', "filter", 1},
+    {'r', "root", 1},
+    {'o', "json", 1},
+    {'s', "seed", 1},
+    {'a', "audio-format", 1},
+  };
+
+  struct OptionParser* parser = option_parser_new(
+      options, sizeof(options) / sizeof(options[0]), argc, argv);
+
+  int done = 0;
+  while (!done) {
+    OptionResult result = option_parser_next(parser);
+    switch (result.kind) {
+      case OPTION_RESULT_KIND_UNKNOWN:
+        PRINT_ERROR("ERROR: Unknown option: %s.\n\n", result.arg);
+        goto error;
+
+      case OPTION_RESULT_KIND_EXPECTED_VALUE:
+        PRINT_ERROR("ERROR: Option --%s requires a value.\n\n",
+                    result.option->long_name);
+        goto error;
+
+      case OPTION_RESULT_KIND_BAD_SHORT_OPTION:
+        PRINT_ERROR("ERROR: Short option -%c is too long: %s.\n\n",
+                    result.option->short_name, result.arg);
+        goto error;
+
+      case OPTION_RESULT_KIND_OPTION:
+        switch (result.option->short_name) {
+          case 'h':
+            goto error;
+
+          case 'f':
+            s_frames = atoi(result.value);
+            break;
+
+          case 'w':
+            s_warmup = atoi(result.value);
+            break;
+
+          case 'n':
+            s_repetitions = atoi(result.value);
+            break;
+
+          case 'S':
+            if (s_suite_count == MAX_SUITES) {
+              PRINT_ERROR("ERROR: Too many suites.\n\n");
+              goto error;
+            }
+            s_suites[s_suite_count++] = result.value;
+            break;
+
+          case 'F':
+            s_filter = result.value;
+            break;
+
+          case 'r':
+            s_root_dir = result.value;
+            break;
+
+          case 'o':
+            s_json_filename = result.value;
+            break;
+
+          case 's':
+            s_random_seed = atoi(result.value);
+            break;
+
+          case 'a': {
+            int format;
+            for (format = 0; format < AUDIO_FORMAT_COUNT; ++format) {
+              if (strcmp(result.value, s_audio_format_names[format]) == 0) {
+                break;
+              }
+            }
+            if (format == AUDIO_FORMAT_COUNT) {
+              PRINT_ERROR("ERROR: Unknown audio format: %s.\n\n",
+                          result.value);
+              goto error;
+            }
+            s_audio_format = (AudioFormat)format;
+            break;
+          }
+
+          default:
+            abort();
+        }
+        break;
+
+      case OPTION_RESULT_KIND_ARG:
+        s_manifest_filename = result.value;
+        break;
+
+      case OPTION_RESULT_KIND_DONE:
+        done = 1;
+        break;
+    }
+  }
+
+  if (s_frames <= 0 || s_warmup < 0 || s_repetitions <= 0 ||
+      s_repetitions > MAX_REPETITIONS) {
+    PRINT_ERROR("ERROR: frames and repetitions must be in 1..%d.\n\n",
+                MAX_REPETITIONS);
+    goto error;
+  }
+
+  if (s_suite_count == 0) {
+    s_suite_count = ARRAY_SIZE(s_default_suites);
+    memcpy(s_suites, s_default_suites, sizeof(s_default_suites));
+  }
+
+  option_parser_delete(parser);
+  return;
+
+error:
+  usage(argc, argv);
+  option_parser_delete(parser);
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  int result = 1;
+  Manifest manifest;
+  ZERO_MEMORY(manifest);
+  BenchResult* results = NULL;
+  parse_options(argc, argv);
+
+  CHECK(SUCCESS(manifest_read(s_manifest_filename, &manifest)));
+  results = xcalloc(manifest.count + 1, sizeof(BenchResult));
+  size_t count = 0, i;
+  for (i = 0; i < manifest.count; ++i) {
+    if (is_selected(&manifest.entries[i])) {
+      results[count++].entry = &manifest.entries[i];
+    }
+  }
+  CHECK_MSG(count > 0, "no ROMs selected.\n");
+
+  printf("frames=%d warmup=%d repetitions=%d audio=%s roms=%d\n", s_frames,
+         s_warmup, s_repetitions, s_audio_format_names[s_audio_format],
+         (int)count);
+  int missing = 0;
+  for (i = 0; i < count; ++i) {
+    bench_rom(&results[i]);
+    missing += !results[i].ran;
+  }
+  if (missing) {
+    printf("skipped %d roms that couldn't be run.\n", missing);
+  }
+
+  print_results(results, count);
+  if (s_json_filename) {
+    CHECK(SUCCESS(write_json(s_json_filename, results, count)));
+  }
+  result = 0;
+
+error:
+  xfree(results);
+  manifest_delete(&manifest);
+  return result;
+}
@@ -50,10 +50,12 @@ static const char* s_rom_filename;
 static const char* s_read_joypad_filename;
 static const char* s_write_joypad_filename;
 static const char* s_save_state_filename;
+static const char* s_channel_capture_prefix;
 static Bool s_running = TRUE;
 static Bool s_step_frame;
 static Bool s_paused;
 static f32 s_audio_volume = 0.5f;
+static AudioFormat s_audio_format = AUDIO_FORMAT_F32;
 static Bool s_rewinding;
 static Ticks s_rewind_start;
 static u32 s_random_seed = 0xcabba6e5;
@@ -67,7 +69,10 @@ static u32 s_audio_frequency = 44100;
 static u32 s_audio_frames = 2048; /* ~46ms of latency at 44.1kHz */
 static u32 s_rewind_frames_per_base_state = 45;
 static u32 s_rewind_buffer_capacity_megabytes = 32;
+static RewindCodec s_rewind_codec = RewindCodec_Rle;
+static Bool s_rewind_thread;
 static f32 s_rewind_scale = 1.5f;
+static u32 s_fast_forward_frames = 4;
 
 static Overlay s_overlay;
 static StatusText s_status_text;
@@ -200,6 +205,7 @@ static void toggle_layer(Layer layer) {
 static void set_no_sync(Bool set) {
   HostConfig host_config = host_get_config(host);
   host_config.no_sync = set;
+  host_config.fast_forward_frames = set ? s_fast_forward_frames : 1;
   host_set_config(host, &host_config);
 }
 
@@ -318,7 +324,9 @@ static void usage(int argc, char** argv) {
       "                            1: Sameboy (Emulate Hardware)\n"
       "                            2: Gambatte/Gameboy Online\n"
       "     --force-dmg          force running as a DMG (original gameboy)\n"
-      "     --sgb-border         draw the super gameboy border\n",
+      "     --sgb-border         draw the super gameboy border\n"
+      "     --capture-channels PREFIX\n"
+      "                          write each sound channel to PREFIX-chN.wav\n",
       argv[0]);
 }
 
@@ -333,6 +341,7 @@ void parse_arguments(int argc, char** argv) {
     {'C', "cgb-color", 1},
     {0, "force-dmg", 0},
     {0, "sgb-border", 0},
+    {0, "capture-channels", 1},
   };
 
   struct OptionParser* parser = option_parser_new(
@@ -391,6 +400,9 @@ void parse_arguments(int argc, char** argv) {
               s_force_dmg = TRUE;
             } else if (strcmp(result.option->long_name, "sgb-border") == 0) {
               s_use_sgb_border = TRUE;
+            } else if (strcmp(result.option->long_name, "capture-channels") ==
+                       0) {
+              s_channel_capture_prefix = result.value;
             } else {
               abort();
             }
@@ -456,6 +468,13 @@ void read_ini_file(void) {
       s_audio_frequency = atoi(value);
     } else if (strcmp(buffer, "audio-frames") == 0) {
       s_audio_frames = atoi(value);
+    } else if (strcmp(buffer, "audio-format") == 0) {
+      int format = atoi(value);
+      if (format >= 0 && format < AUDIO_FORMAT_COUNT) {
+        s_audio_format = (AudioFormat)format;
+      } else {
+        fprintf(stderr, "warning: bad audio-format: %s\n", value);
+      }
     } else if (strcmp(buffer, "builtin-palette") == 0) {
       s_builtin_palette = atoi(value);
     } else if (strcmp(buffer, "force-dmg") == 0) {
@@ -466,8 +485,19 @@ void read_ini_file(void) {
       s_rewind_frames_per_base_state = atoi(value);
     } else if (strcmp(buffer, "rewind-buffer-capacity-megabytes") == 0) {
       s_rewind_buffer_capacity_megabytes = atoi(value);
+    } else if (strcmp(buffer, "rewind-codec") == 0) {
+      int codec = atoi(value);
+      if (codec >= 0 && codec < RewindCodec_Count) {
+        s_rewind_codec = (RewindCodec)codec;
+      } else {
+        fprintf(stderr, "warning: bad rewind-codec: %s\n", value);
+      }
+    } else if (strcmp(buffer, "rewind-thread") == 0) {
+      s_rewind_thread = atoi(value);
     } else if (strcmp(buffer, "rewind-scale") == 0) {
       s_rewind_scale = atof(value);
+    } else if (strcmp(buffer, "fast-forward-frames") == 0) {
+      s_fast_forward_frames = atoi(value);
     } else if (strcmp(buffer, "render-scale") == 0) {
       s_render_scale = atoi(value);
     } else if (strcmp(buffer, "random-seed") == 0) {
@@ -496,10 +526,12 @@ int main(int argc, char** argv) {
   emulator_init.rom = rom;
   emulator_init.audio_frequency = s_audio_frequency;
   emulator_init.audio_frames = s_audio_frames;
+  emulator_init.audio_format = s_audio_format;
   emulator_init.random_seed = s_random_seed;
   emulator_init.builtin_palette = s_builtin_palette;
   emulator_init.force_dmg = s_force_dmg;
   emulator_init.cgb_color_curve = s_cgb_color_curve;
+  emulator_init.capture_channels = s_channel_capture_prefix != NULL;
   e = emulator_new(&emulator_init);
   CHECK(e != NULL);
 
@@ -513,6 +545,9 @@ int main(int argc, char** argv) {
   host_init.audio_volume = s_audio_volume;
   host_init.rewind.frames_per_base_state = s_rewind_frames_per_base_state;
   host_init.rewind.buffer_capacity = s_rewind_buffer_capacity_megabytes * MEGABYTES(1);
+  host_init.rewind.codec = s_rewind_codec;
+  host_init.use_rewind_thread = s_rewind_thread;
+  host_init.channel_capture_prefix = s_channel_capture_prefix;
   host_init.joypad_filename = s_read_joypad_filename;
   host_init.use_sgb_border = s_use_sgb_border;
   host = host_new(&host_init, e);
@@ -10,6 +10,16 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define HAS_MMAP 0
+#endif
+
 const char* replace_extension(const char* filename, const char* extension) {
   size_t length = strlen(filename) + strlen(extension) + 1; /* +1 for \0. */
   char* result = xmalloc(length);
@@ -69,3 +79,60 @@ void file_data_delete(FileData* file_data) {
   file_data->size = 0;
   file_data->data = NULL;
 }
+
+#if HAS_MMAP
+
+Result file_map_aligned(const char* filename, size_t align,
+                        FileData* out_file_data) {
+  u8* data = MAP_FAILED;
+  size_t aligned_size = 0;
+  int fd = open(filename, O_RDONLY);
+  CHECK_MSG(fd >= 0, "unable to open file \"%s\".\n", filename);
+  struct stat st;
+  CHECK_MSG(fstat(fd, &st) == 0, "fstat failed.\n");
+  size_t size = st.st_size;
+  CHECK_MSG(size > 0, "file \"%s\" is empty.\n", filename);
+  aligned_size = ALIGN_UP(size, align);
+  /* Reserve zero pages for the whole aligned size, then map the file over
+   * the start. The rest of the file's last page is zero-filled too, so the
+   * padding never has to be copied. */
+  data = mmap(NULL, aligned_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+              0);
+  CHECK_MSG(data != MAP_FAILED, "mmap failed.\n");
+  CHECK_MSG(mmap(data, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+                data,
+            "mmap of \"%s\" failed.\n", filename);
+  close(fd);
+  out_file_data->data = data;
+  out_file_data->size = aligned_size;
+  return OK;
+error:
+  if (data != MAP_FAILED) {
+    munmap(data, aligned_size);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  return ERROR;
+}
+
+void file_data_unmap(FileData* file_data) {
+  if (file_data->data) {
+    munmap(file_data->data, file_data->size);
+  }
+  file_data->size = 0;
+  file_data->data = NULL;
+}
+
+#else
+
+Result file_map_aligned(const char* filename, size_t align,
+                        FileData* out_file_data) {
+  return file_read_aligned(filename, align, out_file_data);
+}
+
+void file_data_unmap(FileData* file_data) {
+  file_data_delete(file_data);
+}
+
+#endif
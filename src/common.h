@@ -83,6 +83,7 @@ extern "C" {
   }
 
 typedef int8_t s8;
+typedef int16_t s16;
 typedef int32_t s32;
 typedef uint8_t u8;
 typedef uint16_t u16;
@@ -112,6 +113,12 @@ Result file_read(const char* filename, FileData* out);
 Result file_read_aligned(const char* filename, size_t align, FileData* out);
 Result file_write(const char* filename, const FileData*);
 void file_data_delete(FileData*);
+/* Like file_read_aligned, but maps the file read-only instead of reading it,
+ * where supported. Pages are read when first touched, and are shared with
+ * every other mapping of the same file. The padding is zero. The data must
+ * not be written, and must be freed with file_data_unmap. */
+Result file_map_aligned(const char* filename, size_t align, FileData* out);
+void file_data_unmap(FileData*);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -44,6 +44,19 @@ void Debugger::DisablePalette(ImDrawList* draw_list) {
   draw_list->AddCallback(func, host);
 }
 
+int Debugger::GetPaletteTableIndex(const PaletteRGBA& palette) {
+  for (int i = palette_table_count - 1; i >= 0; --i) {
+    if (memcmp(&palette_table[i], &palette, sizeof(palette)) == 0) {
+      return i;
+    }
+  }
+  if (palette_table_count == HOST_PALETTE_TABLE_SIZE) {
+    return -1;
+  }
+  palette_table[palette_table_count] = palette;
+  return palette_table_count++;
+}
+
 bool Debugger::DrawTile(ImDrawList* draw_list, int index, const ImVec2& ul_pos,
                         f32 scale, PaletteRGBA palette, bool xflip,
                         bool yflip) {
@@ -60,10 +73,19 @@ bool Debugger::DrawTile(ImDrawList* draw_list, int index, const ImVec2& ul_pos,
   if (yflip) {
     std::swap(ul_uv.y, br_uv.y);
   }
-  SetPaletteAndEnable(draw_list, palette);
-  draw_list->AddImage((ImTextureID)tile_data_texture->handle, ul_pos, br_pos,
-                      ul_uv, br_uv);
-  DisablePalette(draw_list);
+  // The palette is chosen per vertex, so all tiles are drawn in one batch.
+  // Palettes that don't fit in the table fall back to their own draw call.
+  int palette_index = GetPaletteTableIndex(palette);
+  if (palette_index >= 0) {
+    ImU32 color = IM_COL32(palette_index, 0, 0, 255);
+    draw_list->AddImage((ImTextureID)tile_data_texture->handle, ul_pos, br_pos,
+                        ul_uv, br_uv, color);
+  } else {
+    SetPaletteAndEnable(draw_list, palette);
+    draw_list->AddImage((ImTextureID)tile_data_texture->handle, ul_pos, br_pos,
+                        ul_uv, br_uv);
+    DisablePalette(draw_list);
+  }
   return ImGui::IsMouseHoveringRect(ul_pos, br_pos);
 }
 
@@ -103,19 +125,23 @@ Debugger::Debugger()
       map_window(this),
       memory_window(this),
       obj_window(this),
+      profile_window(this),
       rewind_window(this),
       rom_window(this),
       tiledata_window(this) {}
 
 Debugger::~Debugger() {
   emulator_delete(e);
+  emulator_debug_delete(debug);
   host_delete(host);
 }
 
 bool Debugger::Init(const char* filename, int audio_frequency, int audio_frames,
                     int font_scale, bool paused_at_start, u32 random_seed,
                     u32 builtin_palette, bool force_dmg, bool use_sgb_border,
-                    CgbColorCurve cgb_color_curve) {
+                    CgbColorCurve cgb_color_curve, EmulatorDebug* debug) {
+  this->debug = debug;
+
   FileData rom;
   if (!SUCCESS(file_read_aligned(filename, MINIMUM_ROM_SIZE, &rom))) {
     return false;
@@ -138,6 +164,7 @@ bool Debugger::Init(const char* filename, int audio_frequency, int audio_frames,
   emulator_init.builtin_palette = builtin_palette;
   emulator_init.force_dmg = force_dmg ? TRUE : FALSE;
   emulator_init.cgb_color_curve = cgb_color_curve;
+  emulator_init.debug = debug;
   e = emulator_new(&emulator_init);
   if (e == nullptr) {
     return false;
@@ -186,6 +213,29 @@ bool Debugger::Init(const char* filename, int audio_frequency, int audio_frames,
   return true;
 }
 
+// Only decode and upload the rows of tiles that changed; usually none do.
+void Debugger::UploadTileData() {
+  const int kTileRowHeight = TILE_DATA_TEXTURE_HEIGHT / TILE_DATA_ROWS;
+  u32 dirty_rows = emulator_update_tile_data(e, tile_data);
+  int row = 0;
+  while (row < TILE_DATA_ROWS) {
+    if (!(dirty_rows & (1u << row))) {
+      ++row;
+      continue;
+    }
+    int end = row + 1;
+    while (end < TILE_DATA_ROWS && (dirty_rows & (1u << end))) {
+      ++end;
+    }
+    const int y = row * kTileRowHeight;
+    const int h = (end - row) * kTileRowHeight;
+    host_upload_sub_texture(host, tile_data_texture, 0, y,
+                            TILE_DATA_TEXTURE_WIDTH, h,
+                            &tile_data[y * TILE_DATA_TEXTURE_WIDTH]);
+    row = end;
+  }
+}
+
 void Debugger::Run() {
   emulator_read_ext_ram_from_file(e, save_filename);
 
@@ -222,9 +272,8 @@ void Debugger::Run() {
         break;
     }
 
-    emulator_get_tile_data(e, tile_data);
-    host_upload_texture(host, tile_data_texture, TILE_DATA_TEXTURE_WIDTH,
-                        TILE_DATA_TEXTURE_HEIGHT, tile_data);
+    UploadTileData();
+    palette_table_count = 0;
 
     dockspace_id = ImGui::GetID("Dockspace");
 
@@ -262,6 +311,7 @@ void Debugger::Run() {
         ImGui::DockBuilderDockWindow(s_emulator_window_name, left_top);
         ImGui::DockBuilderDockWindow(s_audio_window_name, left_bottom);
         ImGui::DockBuilderDockWindow(s_rewind_window_name, left_bottom);
+        ImGui::DockBuilderDockWindow(s_profile_window_name, left_bottom);
         ImGui::DockBuilderDockWindow(s_obj_window_name, mid_top);
         ImGui::DockBuilderDockWindow(s_tiledata_window_name, mid_top);
         ImGui::DockBuilderDockWindow(s_map_window_name, mid_bottom);
@@ -277,6 +327,7 @@ void Debugger::Run() {
       emulator_window.Tick();
       audio_window.Tick();
       rewind_window.Tick();
+      profile_window.Tick();
       tiledata_window.Tick();
       obj_window.Tick();
       map_window.Tick();
@@ -288,6 +339,8 @@ void Debugger::Run() {
 
     ImGui::End();
 
+    host_set_palette_table(host, tile_data_texture, palette_table[0].color,
+                           palette_table_count);
     host_end_video(host);
   }
 
@@ -316,7 +369,7 @@ void Debugger::ToggleTrace() {
 
 void Debugger::SetTrace(bool trace) {
   if (run_state != Rewinding) {
-    emulator_set_trace(trace ? TRUE : FALSE);
+    emulator_set_trace(debug, trace ? TRUE : FALSE);
   }
 }
 
@@ -435,6 +488,7 @@ void Debugger::MainMenuBar() {
       ImGui::MenuItem("Disassembly", NULL, &disassembly_window.is_open);
       ImGui::MenuItem("Memory", NULL, &memory_window.is_open);
       ImGui::MenuItem("Rewind", NULL, &rewind_window.is_open);
+      ImGui::MenuItem("Profile", NULL, &profile_window.is_open);
       ImGui::MenuItem("ROM", NULL, &rom_window.is_open);
       ImGui::MenuItem("IO", NULL, &io_window.is_open);
       ImGui::EndMenu();
@@ -467,7 +521,7 @@ std::string Debugger::PrettySize(size_t size) {
 
 void Debugger::BeginAutoRewind() {
   if (run_state == Running || run_state == Paused) {
-    emulator_push_trace(FALSE);
+    emulator_push_trace(debug, FALSE);
     host_begin_rewind(host);
     run_state = AutoRewinding;
   }
@@ -477,7 +531,7 @@ void Debugger::EndAutoRewind() {
   if (run_state == AutoRewinding) {
     host_end_rewind(host);
     run_state = Running;
-    emulator_pop_trace();
+    emulator_pop_trace(debug);
   }
 }
 
@@ -33,7 +33,7 @@ class Debugger {
   bool Init(const char* filename, int audio_frequency, int audio_frames,
             int font_scale, bool paused_at_start, u32 random_seed,
             u32 builtin_palette, bool force_dmg, bool use_sgb_border,
-            CgbColorCurve cgb_color_curve);
+            CgbColorCurve cgb_color_curve, EmulatorDebug* debug);
   void Run();
 
  private:
@@ -52,10 +52,11 @@ class Debugger {
   void ReadStateFromFile();
 
   void SetAudioVolume(f32 volume);
+  void UploadTileData();
 
   void ToggleTrace();
   void SetTrace(bool);
-  bool trace() { return !!emulator_get_trace(); }
+  bool trace() { return !!emulator_get_trace(debug); }
 
   void MainMenuBar();
 
@@ -75,6 +76,10 @@ class Debugger {
               const ImVec2& ul_pos, f32 scale, PaletteRGBA palette, bool xflip,
               bool yflip);
 
+  // Return the palette's index in this frame's palette table, which DrawTile
+  // passes as the vertex color, or -1 if the table is full.
+  int GetPaletteTableIndex(const PaletteRGBA& palette);
+
   void SetPaletteAndEnable(ImDrawList* draw_list, const PaletteRGBA& palette);
   void DisablePalette(ImDrawList* draw_list);
 
@@ -92,6 +97,7 @@ class Debugger {
   EmulatorInit emulator_init;
   HostInit host_init;
   Emulator* e = nullptr;
+  EmulatorDebug* debug = nullptr;  // Owned; deleted after the emulator.
   Host* host = nullptr;
   const char* save_filename = nullptr;
   const char* save_state_filename = nullptr;
@@ -110,6 +116,8 @@ class Debugger {
 
   TileData tile_data;
   HostTexture* tile_data_texture;
+  std::array<PaletteRGBA, HOST_PALETTE_TABLE_SIZE> palette_table;
+  int palette_table_count = 0;
 
   bool is_cgb = false;
   bool is_sgb = false;
@@ -189,6 +197,17 @@ class Debugger {
     int obj_index = 0;
   };
 
+  struct ProfileWindow : Window {
+    explicit ProfileWindow(Debugger*);
+    void Tick();
+
+    int counter = 0;
+    EmulatorProfile last_profile = {};
+    // Collected between the last two updates.
+    u64 clocks[EMULATOR_PROFILE_COUNT] = {};
+    u64 calls[EMULATOR_PROFILE_COUNT] = {};
+  };
+
   struct RewindWindow : Window {
     explicit RewindWindow(Debugger*);
     ~RewindWindow();
@@ -207,8 +226,6 @@ class Debugger {
     int rom_texture_height = 0;
 
     int scale = 1;
-    int counter = 60;
-    size_t usage_bytes[4];
   };
 
   struct TiledataWindow : Window {
@@ -244,6 +261,7 @@ class Debugger {
   MapWindow map_window;
   MemoryWindow memory_window;
   ObjWindow obj_window;
+  ProfileWindow profile_window;
   RewindWindow rewind_window;
   ROMWindow rom_window;
   TiledataWindow tiledata_window;
@@ -255,6 +273,7 @@ class Debugger {
   static const char s_map_window_name[];
   static const char s_memory_window_name[];
   static const char s_obj_window_name[];
+  static const char s_profile_window_name[];
   static const char s_rewind_window_name[];
   static const char s_rom_window_name[];
   static const char s_tiledata_window_name[];
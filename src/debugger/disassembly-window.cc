@@ -124,7 +124,7 @@ void Debugger::DisassemblyWindow::Tick() {
     for (int rom_region = 0; rom_region < 2; ++rom_region) {
       Address region_addr = rom_region << 14;
       int bank = emulator_get_rom_bank(d->e, region_addr);
-      u8* rom_usage = emulator_get_rom_usage() + (bank << 14);
+      u8* rom_usage = emulator_get_rom_usage(d->debug) + (bank << 14);
 
       for (Address rel_addr = 0; rel_addr < 0x4000;) {
         Address addr = region_addr + rel_addr;
@@ -241,9 +241,9 @@ void Debugger::DisassemblyWindow::Tick() {
         if (ImGui::InvisibleButton("##bp", bp_size)) {
           if (bp.valid) {
             if (bp.enabled) {
-              emulator_enable_breakpoint(bp.id, FALSE);
+              emulator_enable_breakpoint(d->e, bp.id, FALSE);
             } else {
-              emulator_remove_breakpoint(bp.id);
+              emulator_remove_breakpoint(d->e, bp.id);
             }
           } else {
             emulator_add_breakpoint(d->e, addr, TRUE);
@@ -21,6 +21,7 @@ static u32 s_builtin_palette;
 static bool s_force_dmg;
 static u32 s_cgb_color_curve;
 static bool s_use_sgb_border;
+static EmulatorDebug* s_debug;
 
 static void usage(int argc, char** argv) {
   PRINT_ERROR(
@@ -85,7 +86,7 @@ void parse_arguments(int argc, char** argv) {
             goto error;
 
           case 't':
-            emulator_set_trace(TRUE);
+            emulator_set_trace(s_debug, TRUE);
             break;
 
           case 'f':
@@ -93,7 +94,8 @@ void parse_arguments(int argc, char** argv) {
             break;
 
           case 'l':
-            switch (emulator_set_log_level_from_string(result.value)) {
+            switch (emulator_set_log_level_from_string(s_debug,
+                                                       result.value)) {
               case SET_LOG_LEVEL_ERROR_NONE:
                 break;
 
@@ -168,13 +170,15 @@ int main(int argc, char** argv) {
   const int audio_frequency = 44100;
   const int audio_frames = 2048;
 
+  s_debug = emulator_debug_new();
   parse_arguments(argc, argv);
 
   Debugger debugger;
   if (!debugger.Init(s_rom_filename, audio_frequency, audio_frames,
                      s_font_scale, s_paused_at_start, s_random_seed,
                      s_builtin_palette, s_force_dmg, s_use_sgb_border,
-                     static_cast<CgbColorCurve>(s_cgb_color_curve))) {
+                     static_cast<CgbColorCurve>(s_cgb_color_curve),
+                     s_debug)) {
     return 1;
   }
   debugger.Run();
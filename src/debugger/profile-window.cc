@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2024 Ben Smith
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.  See the LICENSE file for details.
+ */
+#include "debugger.h"
+
+#include <inttypes.h>
+
+#include "imgui.h"
+#include "imgui-helpers.h"
+
+// static
+const char Debugger::s_profile_window_name[] = "Profile";
+
+Debugger::ProfileWindow::ProfileWindow(Debugger* d) : Window(d) {}
+
+void Debugger::ProfileWindow::Tick() {
+  if (!is_open) return;
+
+  if (ImGui::Begin(Debugger::s_profile_window_name, &is_open)) {
+    EmulatorProfile profile = emulator_get_profile(d->e);
+    if (!profile.enabled) {
+      ImGui::TextWrapped(
+          "Build with -DPROFILE=ON to time each emulator subsystem.");
+      ImGui::End();
+      return;
+    }
+
+    // Show the time spent since the previous update, rather than the total.
+    if (--counter <= 0) {
+      counter = 60;
+      for (int i = 0; i < EMULATOR_PROFILE_COUNT; ++i) {
+        // The profile may have been reset since the last update.
+        bool reset = profile.clocks[i] < last_profile.clocks[i];
+        clocks[i] = profile.clocks[i] - (reset ? 0 : last_profile.clocks[i]);
+        calls[i] = profile.calls[i] - (reset ? 0 : last_profile.calls[i]);
+      }
+      last_profile = profile;
+    }
+
+    u64 total_clocks = 0;
+    for (int i = 0; i < EMULATOR_PROFILE_COUNT; ++i) {
+      total_clocks += clocks[i];
+    }
+
+    if (ImGui::Button("Reset")) {
+      emulator_reset_profile(d->e);
+    }
+    ImGui::SameLine();
+    ImGui::Text("%" PRIu64 " %s", total_clocks, profile.clock_unit);
+    ImGui::Separator();
+
+    ImGui::Columns(4, "profile");
+    ImGui::Text("subsystem");
+    ImGui::NextColumn();
+    ImGui::Text("time");
+    ImGui::NextColumn();
+    ImGui::Text("calls");
+    ImGui::NextColumn();
+    ImGui::Text("%s/call", profile.clock_unit);
+    ImGui::NextColumn();
+    ImGui::Separator();
+    for (int i = 0; i < EMULATOR_PROFILE_COUNT; ++i) {
+      EmulatorProfileKind kind = static_cast<EmulatorProfileKind>(i);
+      f32 fraction = total_clocks ? (f32)clocks[i] / total_clocks : 0;
+      ImGui::Text("%s", emulator_get_profile_kind_name(kind));
+      ImGui::NextColumn();
+      char overlay[16];
+      snprintf(overlay, sizeof(overlay), "%.1f%%", fraction * 100);
+      ImGui::ProgressBar(fraction, ImVec2(-1, 0), overlay);
+      ImGui::NextColumn();
+      ImGui::Text("%" PRIu64, calls[i]);
+      ImGui::NextColumn();
+      ImGui::Text("%.0f", calls[i] ? (f64)clocks[i] / calls[i] : 0.0);
+      ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+  }
+  ImGui::End();
+}
@@ -127,6 +127,13 @@ void Debugger::RewindWindow::Tick() {
     ImGui::Text("rate: %s/sec %s/min %s/hr", d->PrettySize(total / sec).c_str(),
                 d->PrettySize(total / sec * 60).c_str(),
                 d->PrettySize(total / sec * 60 * 60).c_str());
+    ImGui::Text("codec: %s, encode %.1fus, decode %.1fus", rw_stats.codec_name,
+                rw_stats.encode_count
+                    ? rw_stats.total_encode_sec * 1e6 / rw_stats.encode_count
+                    : 0,
+                rw_stats.decode_count
+                    ? rw_stats.total_decode_sec * 1e6 / rw_stats.decode_count
+                    : 0);
 
     Ticks oldest = host_get_rewind_oldest_ticks(d->host);
     Ticks newest = host_get_rewind_newest_ticks(d->host);
@@ -166,7 +173,7 @@ void Debugger::RewindWindow::Tick() {
 
 void Debugger::BeginRewind() {
   if (run_state == Running || run_state == Paused) {
-    emulator_push_trace(FALSE);
+    emulator_push_trace(debug, FALSE);
     host_begin_rewind(host);
     run_state = Rewinding;
   }
@@ -176,6 +183,6 @@ void Debugger::EndRewind() {
   if (run_state == Rewinding) {
     host_end_rewind(host);
     run_state = Running;
-    emulator_pop_trace();
+    emulator_pop_trace(debug);
   }
 }
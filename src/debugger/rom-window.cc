@@ -32,22 +32,31 @@ void Debugger::ROMWindow::Init() {
 
   rom_texture = host_create_texture(d->host, rom_texture_width,
                                     rom_texture_height, HOST_TEXTURE_FORMAT_U8);
-  emulator_clear_rom_usage();
+  emulator_clear_rom_usage(d->debug);
 }
 
 void Debugger::ROMWindow::Tick() {
   if (!is_open) return;
 
   if (ImGui::Begin(Debugger::s_rom_window_name, &is_open)) {
-    host_upload_texture(d->host, rom_texture, rom_texture_width,
-                        rom_texture_height, emulator_get_rom_usage());
+    size_t rom_size = emulator_get_rom_size(d->e);
+    u8* rom_usage = emulator_get_rom_usage(d->debug);
+
+    // Only upload the texture rows that hold ROM usage that changed.
+    u32 begin = 0, end;
+    while (emulator_get_next_rom_usage_change(d->debug, &begin, &end) &&
+           begin < rom_size) {
+      int y = begin / rom_texture_width;
+      int h = (std::min<size_t>(end, rom_size) + rom_texture_width - 1) /
+                  rom_texture_width - y;
+      host_upload_sub_texture(d->host, rom_texture, 0, y, rom_texture_width, h,
+                              rom_usage + y * rom_texture_width);
+      begin = end;
+    }
 
     PaletteRGBA palette = {
         {0xff202020u, 0xff00ff00u, 0xffff0000u, 0xffff00ffu}};
 
-    size_t rom_size = emulator_get_rom_size(d->e);
-    u8* rom_usage = emulator_get_rom_usage();
-
     if (ImGui::Button("Dump")) {
       FileData file_data;
       file_data.data = rom_usage;
@@ -56,20 +65,24 @@ void Debugger::ROMWindow::Tick() {
     }
     ImGui::SliderInt("Scale", &scale, 1, 16);
 
-    if (--counter <= 0) {
-      counter = 60;
-      ZERO_MEMORY(usage_bytes);
-      for (size_t i = 0; i < rom_size; ++i) {
-        usage_bytes[rom_usage[i]]++;
+    // Code bytes may also be read as data; count them as code.
+    const u32* counts = emulator_get_rom_usage_counts(d->debug);
+    size_t data_bytes = counts[ROM_USAGE_DATA];
+    size_t code_bytes = 0;
+    for (int i = 0; i < ROM_USAGE_VALUES; ++i) {
+      if (i & ROM_USAGE_CODE) {
+        code_bytes += counts[i];
       }
     }
-
-    ImGui::Text("Unknown: %s (%.0f%%)", d->PrettySize(usage_bytes[0]).c_str(),
-                (f64)usage_bytes[0] * 100 / rom_size);
-    ImGui::Text("Data: %s (%.0f%%)", d->PrettySize(usage_bytes[2]).c_str(),
-                (f64)usage_bytes[2] * 100 / rom_size);
-    ImGui::Text("Code: %s (%.0f%%)", d->PrettySize(usage_bytes[3]).c_str(),
-                (f64)usage_bytes[3] * 100 / rom_size);
+    size_t unknown_bytes =
+        rom_size - std::min(rom_size, data_bytes + code_bytes);
+
+    ImGui::Text("Unknown: %s (%.0f%%)", d->PrettySize(unknown_bytes).c_str(),
+                (f64)unknown_bytes * 100 / rom_size);
+    ImGui::Text("Data: %s (%.0f%%)", d->PrettySize(data_bytes).c_str(),
+                (f64)data_bytes * 100 / rom_size);
+    ImGui::Text("Code: %s (%.0f%%)", d->PrettySize(code_bytes).c_str(),
+                (f64)code_bytes * 100 / rom_size);
 
     ImGui::Separator();
 
@@ -26,6 +26,8 @@ static Emulator* e;
 static EmulatorConfig s_config;
 static EmulatorInit s_init;
 static JoypadButtons s_buttons;
+static ApuWrite* s_apu_log_writes;
+static size_t s_apu_log_capacity;
 
 Emulator* emulator_new_simple(void* rom_data, size_t rom_size,
                               int audio_frequency, int audio_frames,
@@ -82,6 +84,7 @@ RewindBuffer* rewind_new_simple(Emulator* e, int frames_per_base_state,
   RewindInit init;
   init.frames_per_base_state = frames_per_base_state;
   init.buffer_capacity = buffer_capacity;
+  init.codec = RewindCodec_Rle;
   return rewind_new(&init, e);
 }
 
@@ -195,14 +198,20 @@ void set_log_apu_writes(Emulator* e, Bool set) {
   emulator_set_config(e, &s_config);
 }
 
-size_t get_apu_log_data_size(Emulator* e) {
-  ApuLog* apu_log = emulator_get_apu_log(e);
-  return apu_log->write_count * sizeof(apu_log->writes[0]);
+/* Move all logged writes to a buffer that JS can read from
+ * get_apu_log_data_ptr; returns its size in bytes. */
+size_t drain_apu_log(Emulator* e) {
+  size_t count = emulator_get_apu_log_count(e);
+  if (count > s_apu_log_capacity) {
+    xfree(s_apu_log_writes);
+    s_apu_log_capacity = count;
+    s_apu_log_writes = xmalloc(count * sizeof(ApuWrite));
+  }
+  return emulator_drain_apu_log(e, s_apu_log_writes, count) * sizeof(ApuWrite);
 }
 
 void* get_apu_log_data_ptr(Emulator* e) {
-  ApuLog* apu_log = emulator_get_apu_log(e);
-  return &apu_log->writes[0];
+  return s_apu_log_writes;
 }
 
 void reset_apu_log(Emulator* e) { return emulator_reset_apu_log(e); }
@@ -11,14 +11,40 @@
 
 #define MAX_TRACE_STACK 16
 #define MAX_BREAKPOINTS 256
-static Bool s_trace_stack[MAX_TRACE_STACK] = {FALSE};
-static size_t s_trace_stack_top = 1;
-static LogLevel s_log_level[NUM_LOG_SYSTEMS] = {1, 1, 1, 1, 1, 1};
-static Breakpoint s_breakpoints[MAX_BREAKPOINTS];
-static Address s_breakpoint_mask[2];
+
+struct EmulatorDebug {
+  Bool trace_stack[MAX_TRACE_STACK];
+  size_t trace_stack_top;
+  LogLevel log_level[NUM_LOG_SYSTEMS];
+
+  Breakpoint breakpoints[MAX_BREAKPOINTS];
+  Address breakpoint_mask[2];
+  int breakpoint_count;
+  int breakpoint_max_id;
+
+  /* Store as 1-1 mapping of bytes, low 3 bits used only. */
+  Bool rom_usage_enabled;
+  u8* rom_usage; /* MAXIMUM_ROM_SIZE bytes. */
+  u32 rom_usage_counts[ROM_USAGE_VALUES];
+  u32 rom_usage_changed[MAXIMUM_ROM_SIZE / ROM_USAGE_BLOCK_SIZE / 32];
+
+  Bool opcode_count_enabled;
+  u32 opcode_count[256];
+  u32 cb_opcode_count[256];
+  Bool profiling_enabled;
+  u32* profiling_counters; /* MAXIMUM_ROM_SIZE entries. */
+
+  /* Tiles written since emulator_update_tile_data last decoded them. */
+  u32 dirty_tiles[TILE_DATA_ROWS * TILE_DATA_ROW_TILES / 32];
+};
+
 static const Breakpoint s_invalid_breakpoint;
-static int s_breakpoint_count;
-static int s_breakpoint_max_id;
+
+/* debug is the context the hooks use; own_debug is the one created by
+ * emulator_new, used when no other context is attached. */
+#define EMULATOR_DEBUG_FIELDS \
+  EmulatorDebug* debug;       \
+  EmulatorDebug* own_debug;
 
 #define HOOK0(name) HOOK_##name(e, __func__)
 #define HOOK(name, ...) HOOK_##name(e, __func__, __VA_ARGS__)
@@ -29,7 +55,7 @@ static int s_breakpoint_max_id;
 
 #define DEFINE_LOG_HOOK(system, level, name, format)                        \
   void HOOK_##name(Emulator* e, const char* func_name, ...) {               \
-    if (s_log_level[LOG_SYSTEM_##system] >= LOG_LEVEL_##level) {            \
+    if (e->debug->log_level[LOG_SYSTEM_##system] >= LOG_LEVEL_##level) {    \
       va_list args;                                                         \
       va_start(args, func_name);                                            \
       fprintf(stdout, "%10" PRIu64 ": %-30s:", e->state.ticks, func_name); \
@@ -114,12 +140,18 @@ static int s_breakpoint_max_id;
   X(M, D, write_io_ignored_as, "(%#04x, %#02x) ignored")                       \
   X(M, D, write_ram_disabled_ab, "(%#04x, %#02x) ignored, ram disabled")
 
+static void HOOK_emulator_new_p(Emulator*, const char* func_name,
+                                EmulatorDebug*);
+static void HOOK_emulator_delete(Emulator*, const char* func_name);
 static Bool HOOK_emulator_step(Emulator*, const char* func_name);
+static Bool HOOK_idle_fast_forward(Emulator*, const char* func_name);
 static void HOOK_read_rom_ib(Emulator*, const char* func_name, u32 rom_addr,
                              u8 value);
 static void HOOK_exec_op_ai(Emulator*, const char* func_name, Address,
                             u8 opcode);
 static void HOOK_exec_cb_op_i(Emulator*, const char* func_name, u8 opcode);
+static void HOOK_write_vram_i(Emulator*, const char* func_name, u32 offset);
+static void HOOK_read_state(Emulator*, const char* func_name);
 
 FOREACH_LOG_HOOKS(DECLARE_LOG_HOOK)
 
@@ -378,16 +410,19 @@ void emulator_disassemble_rom(Emulator* e, u32 rom_addr, char* buffer,
 
 Registers emulator_get_registers(Emulator* e) { return REG; }
 
-int emulator_get_max_breakpoint_id(void) {
-  return s_breakpoint_max_id;
+int emulator_get_max_breakpoint_id(Emulator* e) {
+  return e->debug->breakpoint_max_id;
 }
 
-static Bool is_breakpoint_valid(int id) {
-  return id >= 0 && id < s_breakpoint_max_id && s_breakpoints[id].valid;
+static Bool is_breakpoint_valid(EmulatorDebug* debug, int id) {
+  return id >= 0 && id < debug->breakpoint_max_id &&
+         debug->breakpoints[id].valid;
 }
 
-Breakpoint emulator_get_breakpoint(int id) {
-  return is_breakpoint_valid(id) ? s_breakpoints[id] : s_invalid_breakpoint;
+Breakpoint emulator_get_breakpoint(Emulator* e, int id) {
+  EmulatorDebug* debug = e->debug;
+  return is_breakpoint_valid(debug, id) ? debug->breakpoints[id]
+                                        : s_invalid_breakpoint;
 }
 
 static Bool address_matches_bank(Emulator* e, Address addr, int bank) {
@@ -395,45 +430,47 @@ static Bool address_matches_bank(Emulator* e, Address addr, int bank) {
 }
 
 Breakpoint emulator_get_breakpoint_by_address(Emulator* e, Address addr) {
-  if (s_breakpoint_count == 0) {
+  EmulatorDebug* debug = e->debug;
+  if (debug->breakpoint_count == 0) {
     return s_invalid_breakpoint;
   }
   int id;
-  for (id = 0; id < s_breakpoint_max_id; ++id) {
-    Breakpoint* bp = &s_breakpoints[id];
+  for (id = 0; id < debug->breakpoint_max_id; ++id) {
+    Breakpoint* bp = &debug->breakpoints[id];
     if (bp->valid && bp->addr == addr &&
         address_matches_bank(e, addr, bp->bank)) {
-      return s_breakpoints[id];
+      return *bp;
     }
   }
   return s_invalid_breakpoint;
 }
 
-static void calculate_breakpoint_mask(void) {
-  s_breakpoint_mask[0] = 0xffffu;
-  s_breakpoint_mask[1] = 0xffffu;
+static void calculate_breakpoint_mask(EmulatorDebug* debug) {
+  debug->breakpoint_mask[0] = 0xffffu;
+  debug->breakpoint_mask[1] = 0xffffu;
   int id;
-  for (id = 0; id < s_breakpoint_max_id; ++id) {
-    Breakpoint* bp = &s_breakpoints[id];
+  for (id = 0; id < debug->breakpoint_max_id; ++id) {
+    Breakpoint* bp = &debug->breakpoints[id];
     if (!(bp->valid && bp->enabled)) {
       continue;
     }
-    s_breakpoint_mask[0] &= ~bp->addr;
-    s_breakpoint_mask[1] &= bp->addr;
+    debug->breakpoint_mask[0] &= ~bp->addr;
+    debug->breakpoint_mask[1] &= bp->addr;
   }
 }
 
-int emulator_add_empty_breakpoint(void) {
+int emulator_add_empty_breakpoint(Emulator* e) {
+  EmulatorDebug* debug = e->debug;
   int id;
   for (id = 0; id < MAX_BREAKPOINTS; ++id) {
-    Breakpoint* bp = &s_breakpoints[id];
+    Breakpoint* bp = &debug->breakpoints[id];
     if (!bp->valid) {
       bp->id = id;
       bp->addr = bp->bank = 0;
       bp->enabled = FALSE;
       bp->valid = TRUE;
-      s_breakpoint_max_id = MAX(id + 1, s_breakpoint_max_id);
-      ++s_breakpoint_count;
+      debug->breakpoint_max_id = MAX(id + 1, debug->breakpoint_max_id);
+      ++debug->breakpoint_count;
       return id;
     }
   }
@@ -441,46 +478,49 @@ int emulator_add_empty_breakpoint(void) {
 }
 
 int emulator_add_breakpoint(Emulator* e, Address addr, Bool enabled) {
-  int id = emulator_add_empty_breakpoint();
+  int id = emulator_add_empty_breakpoint(e);
   if (id < 0) {
     return id;
   }
   emulator_set_breakpoint_address(e, id, addr);
-  emulator_enable_breakpoint(id, enabled);
+  emulator_enable_breakpoint(e, id, enabled);
   return id;
 }
 
 void emulator_set_breakpoint_address(Emulator* e, int id, Address addr) {
-  if (!is_breakpoint_valid(id)) {
+  EmulatorDebug* debug = e->debug;
+  if (!is_breakpoint_valid(debug, id)) {
     return;
   }
-  Breakpoint* bp = &s_breakpoints[id];
+  Breakpoint* bp = &debug->breakpoints[id];
   bp->addr = addr;
   bp->bank = emulator_get_rom_bank(e, addr);
-  calculate_breakpoint_mask();
+  calculate_breakpoint_mask(debug);
 }
 
-void emulator_enable_breakpoint(int id, Bool enabled) {
-  if (!is_breakpoint_valid(id)) {
+void emulator_enable_breakpoint(Emulator* e, int id, Bool enabled) {
+  EmulatorDebug* debug = e->debug;
+  if (!is_breakpoint_valid(debug, id)) {
     return;
   }
-  s_breakpoints[id].enabled = enabled;
-  calculate_breakpoint_mask();
+  debug->breakpoints[id].enabled = enabled;
+  calculate_breakpoint_mask(debug);
 }
 
-void emulator_remove_breakpoint(int id) {
-  if (!is_breakpoint_valid(id)) {
+void emulator_remove_breakpoint(Emulator* e, int id) {
+  EmulatorDebug* debug = e->debug;
+  if (!is_breakpoint_valid(debug, id)) {
     return;
   }
-  s_breakpoints[id].valid = FALSE;
-  if (id + 1 == s_breakpoint_max_id) {
-    while (s_breakpoint_max_id > 0 &&
-           !s_breakpoints[s_breakpoint_max_id - 1].valid) {
-      s_breakpoint_max_id--;
+  debug->breakpoints[id].valid = FALSE;
+  if (id + 1 == debug->breakpoint_max_id) {
+    while (debug->breakpoint_max_id > 0 &&
+           !debug->breakpoints[debug->breakpoint_max_id - 1].valid) {
+      debug->breakpoint_max_id--;
     }
   }
-  calculate_breakpoint_mask();
-  --s_breakpoint_count;
+  calculate_breakpoint_mask(debug);
+  --debug->breakpoint_count;
 }
 
 int emulator_get_rom_bank(Emulator* e, Address addr) {
@@ -500,39 +540,84 @@ void emulator_write_u8_raw(Emulator* e, Address addr, u8 value) {
   write_u8_raw(e, addr, value);
 }
 
-// Store as 1-1 mapping of bytes, low 3 bits used only.
-static Bool s_rom_usage_enabled = TRUE;
-static u8 s_rom_usage[MAXIMUM_ROM_SIZE];
+Bool emulator_get_rom_usage_enabled(EmulatorDebug* debug) {
+  return debug->rom_usage_enabled;
+}
+
+void emulator_set_rom_usage_enabled(EmulatorDebug* debug, Bool enable) {
+  debug->rom_usage_enabled = enable;
+}
+
+static inline void mark_rom_usage(EmulatorDebug* debug, u32 rom_addr,
+                                  RomUsage usage) {
+  assert(rom_addr < MAXIMUM_ROM_SIZE);
+  u8 old_usage = debug->rom_usage[rom_addr];
+  u8 new_usage = old_usage | usage;
+  if (LIKELY(new_usage == old_usage)) {
+    return;
+  }
+  debug->rom_usage[rom_addr] = new_usage;
+  if (old_usage) {
+    debug->rom_usage_counts[old_usage]--;
+  }
+  debug->rom_usage_counts[new_usage]++;
+  u32 block = rom_addr / ROM_USAGE_BLOCK_SIZE;
+  debug->rom_usage_changed[block >> 5] |= 1u << (block & 31);
+}
 
-Bool emulator_get_rom_usage_enabled(void) {
-  return s_rom_usage_enabled;
+u8* emulator_get_rom_usage(EmulatorDebug* debug) {
+  assert(debug->rom_usage_enabled);
+  return debug->rom_usage;
 }
 
-void emulator_set_rom_usage_enabled(Bool enable) {
-  s_rom_usage_enabled = enable;
+void emulator_clear_rom_usage(EmulatorDebug* debug) {
+  assert(debug->rom_usage_enabled);
+  memset(debug->rom_usage, 0, MAXIMUM_ROM_SIZE);
+  ZERO_MEMORY(debug->rom_usage_counts);
+  memset(debug->rom_usage_changed, 0xff, sizeof(debug->rom_usage_changed));
 }
 
-static inline void mark_rom_usage(u32 rom_addr, RomUsage usage) {
-  assert(rom_addr < ARRAY_SIZE(s_rom_usage));
-  s_rom_usage[rom_addr] |= usage;
+const u32* emulator_get_rom_usage_counts(EmulatorDebug* debug) {
+  return debug->rom_usage_counts;
 }
 
-u8* emulator_get_rom_usage(void) {
-  assert(s_rom_usage_enabled);
-  return s_rom_usage;
+static Bool is_rom_usage_block_changed(EmulatorDebug* debug, u32 block) {
+  return (debug->rom_usage_changed[block >> 5] >> (block & 31)) & 1;
 }
 
-void emulator_clear_rom_usage(void) {
-  assert(s_rom_usage_enabled);
-  memset(s_rom_usage, 0, sizeof(s_rom_usage));
+Bool emulator_get_next_rom_usage_change(EmulatorDebug* debug, u32* begin,
+                                        u32* end) {
+  const u32 block_count = MAXIMUM_ROM_SIZE / ROM_USAGE_BLOCK_SIZE;
+  u32 block = *begin / ROM_USAGE_BLOCK_SIZE;
+  /* Skip whole words of unchanged blocks. */
+  while (block < block_count) {
+    if (debug->rom_usage_changed[block >> 5] >> (block & 31)) {
+      break;
+    }
+    block = (block | 31) + 1;
+  }
+  while (block < block_count && !is_rom_usage_block_changed(debug, block)) {
+    ++block;
+  }
+  if (block >= block_count) {
+    return FALSE;
+  }
+  u32 first = block;
+  while (block < block_count && is_rom_usage_block_changed(debug, block)) {
+    debug->rom_usage_changed[block >> 5] &= ~(1u << (block & 31));
+    ++block;
+  }
+  *begin = first * ROM_USAGE_BLOCK_SIZE;
+  *end = block * ROM_USAGE_BLOCK_SIZE;
+  return TRUE;
 }
 
 void HOOK_read_rom_ib(Emulator* e, const char* func_name, u32 rom_addr,
                       u8 value) {
-  if (!s_rom_usage_enabled) {
+  if (!e->debug->rom_usage_enabled) {
     return;
   }
-  mark_rom_usage(rom_addr, ROM_USAGE_DATA);
+  mark_rom_usage(e->debug, rom_addr, ROM_USAGE_DATA);
 }
 
 #define INVALID_ROM_ADDR (~0u)
@@ -548,39 +633,42 @@ static u32 get_rom_addr(Emulator* e, Address addr) {
 }
 
 static void mark_rom_usage_for_pc(Emulator* e, u32 rom_addr) {
-  if (!s_rom_usage_enabled || rom_addr == INVALID_ROM_ADDR) {
+  EmulatorDebug* debug = e->debug;
+  if (!debug->rom_usage_enabled || rom_addr == INVALID_ROM_ADDR) {
     return;
   }
   u8 opcode = e->cart_info->data[rom_addr];
   u8 count = s_opcode_bytes[opcode];
-  mark_rom_usage(rom_addr, ROM_USAGE_CODE | ROM_USAGE_CODE_START);
+  mark_rom_usage(debug, rom_addr, ROM_USAGE_CODE | ROM_USAGE_CODE_START);
   switch (count) {
     case 3:
-      mark_rom_usage(rom_addr + 2, ROM_USAGE_CODE);
+      mark_rom_usage(debug, rom_addr + 2, ROM_USAGE_CODE);
       /* fallthrough */
     case 2:
-      mark_rom_usage(rom_addr + 1, ROM_USAGE_CODE);
+      mark_rom_usage(debug, rom_addr + 1, ROM_USAGE_CODE);
       /* fallthrough */
   }
 }
 
-static Bool address_matches_breakpoint_mask(Address addr) {
-  return (addr & s_breakpoint_mask[0]) == 0 &&
-         (addr & s_breakpoint_mask[1]) == s_breakpoint_mask[1];
+static Bool address_matches_breakpoint_mask(EmulatorDebug* debug,
+                                            Address addr) {
+  return (addr & debug->breakpoint_mask[0]) == 0 &&
+         (addr & debug->breakpoint_mask[1]) == debug->breakpoint_mask[1];
 }
 
 static inline Bool hit_breakpoint(Emulator* e) {
-  if (s_breakpoint_count == 0) {
+  EmulatorDebug* debug = e->debug;
+  if (debug->breakpoint_count == 0) {
     return FALSE;
   }
   u16 pc = e->state.reg.PC;
-  if (!address_matches_breakpoint_mask(pc)) {
+  if (!address_matches_breakpoint_mask(debug, pc)) {
     return FALSE;
   }
   Bool hit = FALSE;
   int id;
-  for (id = 0; id < s_breakpoint_max_id; ++id) {
-    Breakpoint* bp = &s_breakpoints[id];
+  for (id = 0; id < debug->breakpoint_max_id; ++id) {
+    Breakpoint* bp = &debug->breakpoints[id];
     if (!(bp->valid && bp->enabled && bp->addr == pc &&
           address_matches_bank(e, pc, bp->bank))) {
       continue;
@@ -597,7 +685,7 @@ static inline Bool hit_breakpoint(Emulator* e) {
 }
 
 Bool HOOK_emulator_step(Emulator* e, const char* func_name) {
-  if (emulator_get_trace() && INTR.state < CPU_STATE_HALT) {
+  if (emulator_get_trace(e->debug) && INTR.state < CPU_STATE_HALT) {
     u8 F = 0;
     if (REG.F.Z) F |= 0x80;
     if (REG.F.N) F |= 0x40;
@@ -605,11 +693,11 @@ Bool HOOK_emulator_step(Emulator* e, const char* func_name) {
     if (REG.F.C) F |= 0x10;
     printf("PC:%04X AF:%02X%02X BC:%04X DE:%04X HL:%04X SP:%04X", REG.PC, REG.A, F, REG.BC, REG.DE, REG.HL, REG.SP);
     //printf(" (cy: %" PRIu64 ")", e->state.ticks);
-    //if (s_log_level[LOG_SYSTEM_PPU] >= 1) {
+    //if (e->debug->log_level[LOG_SYSTEM_PPU] >= 1) {
     //  printf(" ppu:%c%u", PPU.lcdc.display ? '+' : '-', PPU.stat.mode);
     //  printf(" LY:%u", PPU.ly);
     //}
-    //if (s_log_level[LOG_SYSTEM_PPU] >= 2) {
+    //if (e->debug->log_level[LOG_SYSTEM_PPU] >= 2) {
     //  printf(" LY:%u", PPU.ly);
     //}
     //printf(" |");
@@ -623,66 +711,69 @@ Bool HOOK_emulator_step(Emulator* e, const char* func_name) {
   return FALSE;
 }
 
-static Bool s_opcode_count_enabled = FALSE;
-static u32 s_opcode_count[256];
-static u32 s_cb_opcode_count[256];
-static Bool s_profiling_enabled = FALSE;
-static u32 s_profiling_counters[MAXIMUM_ROM_SIZE];
+/* Skipping idle time would hide steps from tracing, breakpoints, logging and
+ * the counters below, so the debug build always steps. */
+Bool HOOK_idle_fast_forward(Emulator* e, const char* func_name) {
+  return TRUE;
+}
 
-Bool emulator_get_opcode_count_enabled(void) {
-  return s_opcode_count_enabled;
+Bool emulator_get_opcode_count_enabled(EmulatorDebug* debug) {
+  return debug->opcode_count_enabled;
 }
 
-void emulator_set_opcode_count_enabled(Bool enable) {
-  s_opcode_count_enabled = enable;
+void emulator_set_opcode_count_enabled(EmulatorDebug* debug, Bool enable) {
+  debug->opcode_count_enabled = enable;
 }
 
-u32* emulator_get_opcode_count(void) {
-  assert(s_opcode_count_enabled);
-  return s_opcode_count;
+u32* emulator_get_opcode_count(EmulatorDebug* debug) {
+  assert(debug->opcode_count_enabled);
+  return debug->opcode_count;
 }
 
-u32* emulator_get_cb_opcode_count(void) {
-  assert(s_opcode_count_enabled);
-  return s_cb_opcode_count;
+u32* emulator_get_cb_opcode_count(EmulatorDebug* debug) {
+  assert(debug->opcode_count_enabled);
+  return debug->cb_opcode_count;
 }
 
-Bool emulator_get_profiling_enabled(void) {
-  return s_profiling_enabled;
+Bool emulator_get_profiling_enabled(EmulatorDebug* debug) {
+  return debug->profiling_enabled;
 }
 
-void emulator_set_profiling_enabled(Bool enable) {
-  s_profiling_enabled = enable;
+void emulator_set_profiling_enabled(EmulatorDebug* debug, Bool enable) {
+  debug->profiling_enabled = enable;
 }
 
-u32* emulator_get_profiling_counters(void) {
-  return s_profiling_counters;
+u32* emulator_get_profiling_counters(EmulatorDebug* debug) {
+  return debug->profiling_counters;
 }
 
 void HOOK_exec_op_ai(Emulator* e, const char* func_name, Address pc,
                      u8 opcode) {
+  EmulatorDebug* debug = e->debug;
   u32 rom_addr = get_rom_addr(e, pc);
   mark_rom_usage_for_pc(e, rom_addr);
-  if (s_opcode_count_enabled) {
-    s_opcode_count[opcode]++;
+  if (debug->opcode_count_enabled) {
+    debug->opcode_count[opcode]++;
   }
-  if (s_profiling_enabled && rom_addr != INVALID_ROM_ADDR) {
-    s_profiling_counters[rom_addr]++;
+  if (debug->profiling_enabled && rom_addr != INVALID_ROM_ADDR) {
+    debug->profiling_counters[rom_addr]++;
   }
 }
 
 void HOOK_exec_cb_op_i(Emulator* e, const char* func_name, u8 opcode) {
-  if (s_opcode_count_enabled) {
-    s_cb_opcode_count[opcode]++;
+  if (e->debug->opcode_count_enabled) {
+    e->debug->cb_opcode_count[opcode]++;
   }
 }
 
-void emulator_set_log_level(LogSystem system, LogLevel level) {
+void emulator_set_log_level(EmulatorDebug* debug, LogSystem system,
+                            LogLevel level) {
   assert(system < NUM_LOG_SYSTEMS);
-  s_log_level[system] = level;
+  debug->log_level[system] = level;
 }
 
-SetLogLevelError emulator_set_log_level_from_string(const char* s) {
+SetLogLevelError emulator_set_log_level_from_string(EmulatorDebug* debug,
+                                                    const char* s) {
   const char* log_system_name = s;
   const char* equals = strchr(s, '=');
   if (!equals) {
@@ -703,26 +794,26 @@ SetLogLevelError emulator_set_log_level_from_string(const char* s) {
     return SET_LOG_LEVEL_ERROR_UNKNOWN_LOG_SYSTEM;
   }
 
-  emulator_set_log_level(system, atoi(equals + 1));
+  emulator_set_log_level(debug, system, atoi(equals + 1));
   return SET_LOG_LEVEL_ERROR_NONE;
 }
 
-Bool emulator_get_trace() {
-  return s_trace_stack[s_trace_stack_top - 1];
+Bool emulator_get_trace(EmulatorDebug* debug) {
+  return debug->trace_stack[debug->trace_stack_top - 1];
 }
 
-void emulator_set_trace(Bool trace) {
-  s_trace_stack[s_trace_stack_top - 1] = trace;
+void emulator_set_trace(EmulatorDebug* debug, Bool trace) {
+  debug->trace_stack[debug->trace_stack_top - 1] = trace;
 }
 
-void emulator_push_trace(Bool trace) {
-  assert(s_trace_stack_top < MAX_TRACE_STACK);
-  s_trace_stack[s_trace_stack_top++] = trace;
+void emulator_push_trace(EmulatorDebug* debug, Bool trace) {
+  assert(debug->trace_stack_top < MAX_TRACE_STACK);
+  debug->trace_stack[debug->trace_stack_top++] = trace;
 }
 
-void emulator_pop_trace() {
-  assert(s_trace_stack_top > 1);
-  --s_trace_stack_top;
+void emulator_pop_trace(EmulatorDebug* debug) {
+  assert(debug->trace_stack_top > 1);
+  --debug->trace_stack_top;
 }
 
 const char* emulator_get_log_system_name(LogSystem system) {
@@ -737,9 +828,9 @@ const char* emulator_get_log_system_name(LogSystem system) {
   }
 }
 
-LogLevel emulator_get_log_level(LogSystem system) {
+LogLevel emulator_get_log_level(EmulatorDebug* debug, LogSystem system) {
   assert(system < NUM_LOG_SYSTEMS);
-  return s_log_level[system];
+  return debug->log_level[system];
 }
 
 void emulator_print_log_systems(void) {
@@ -750,6 +841,52 @@ void emulator_print_log_systems(void) {
   }
 }
 
+EmulatorDebug* emulator_debug_new(void) {
+  EmulatorDebug* debug = xcalloc(1, sizeof(EmulatorDebug));
+  debug->trace_stack_top = 1;
+  int i;
+  for (i = 0; i < NUM_LOG_SYSTEMS; ++i) {
+    debug->log_level[i] = LOG_LEVEL_INFO;
+  }
+  debug->rom_usage_enabled = TRUE;
+  /* These are only touched when their feature is used, so most of the pages
+   * are never committed. */
+  debug->rom_usage = xcalloc(1, MAXIMUM_ROM_SIZE);
+  debug->profiling_counters = xcalloc(MAXIMUM_ROM_SIZE, sizeof(u32));
+  return debug;
+}
+
+void emulator_debug_delete(EmulatorDebug* debug) {
+  if (debug) {
+    xfree(debug->profiling_counters);
+    xfree(debug->rom_usage);
+    xfree(debug);
+  }
+}
+
+static void mark_all_tiles_dirty(EmulatorDebug* debug) {
+  memset(debug->dirty_tiles, 0xff, sizeof(debug->dirty_tiles));
+}
+
+void emulator_set_debug(Emulator* e, EmulatorDebug* debug) {
+  e->debug = debug ? debug : e->own_debug;
+  mark_all_tiles_dirty(e->debug);
+}
+
+EmulatorDebug* emulator_get_debug(Emulator* e) {
+  return e->debug;
+}
+
+void HOOK_emulator_new_p(Emulator* e, const char* func_name,
+                         EmulatorDebug* debug) {
+  e->own_debug = emulator_debug_new();
+  emulator_set_debug(e, debug);
+}
+
+void HOOK_emulator_delete(Emulator* e, const char* func_name) {
+  emulator_debug_delete(e->own_debug);
+}
+
 Bool emulator_is_cgb(Emulator* e) { return e->state.is_cgb; }
 Bool emulator_is_sgb(Emulator* e) { return e->state.is_sgb; }
 
@@ -808,35 +945,68 @@ PaletteRGBA emulator_get_sgb_palette_rgba(Emulator* e, int index) {
   return e->sgb_pal[index];
 }
 
+#define TILE_DATA_BANK_TILES 384
+#define TILE_DATA_TILE_COUNT (TILE_DATA_ROWS * TILE_DATA_ROW_TILES)
+#define TILE_BYTES (TILE_HEIGHT * TILE_ROW_BYTES)
+
+void HOOK_write_vram_i(Emulator* e, const char* func_name, u32 offset) {
+  u32 bank_offset = offset & ADDR_MASK_8K;
+  if (bank_offset < TILE_DATA_BANK_TILES * TILE_BYTES) {
+    u32 tile = (offset >> 13) * TILE_DATA_BANK_TILES + bank_offset / TILE_BYTES;
+    e->debug->dirty_tiles[tile >> 5] |= 1u << (tile & 31);
+  }
+}
+
+void HOOK_read_state(Emulator* e, const char* func_name) {
+  mark_all_tiles_dirty(e->debug);
+}
+
+/* Tile |tile| is at row tile / TILE_DATA_ROW_TILES of the texture. Each bank
+ * has a whole number of rows, so the rows of bank 1 follow bank 0's. */
+static void decode_tile(Emulator* e, int tile, TileData out_tile_data) {
+  assert(TILE_DATA_BANK_TILES % TILE_DATA_ROW_TILES == 0);
+  assert(TILE_DATA_ROW_TILES * TILE_WIDTH == TILE_DATA_TEXTURE_WIDTH);
+  assert(TILE_DATA_ROWS * TILE_HEIGHT == TILE_DATA_TEXTURE_HEIGHT);
+  const u8* src =
+      &e->state.vram.data[(tile / TILE_DATA_BANK_TILES) * 0x2000 +
+                          (tile % TILE_DATA_BANK_TILES) * TILE_BYTES];
+  u8* dst = &out_tile_data[(tile / TILE_DATA_ROW_TILES) * TILE_HEIGHT *
+                               TILE_DATA_TEXTURE_WIDTH +
+                           (tile % TILE_DATA_ROW_TILES) * TILE_WIDTH];
+  int my;
+  for (my = 0; my < TILE_HEIGHT; ++my) {
+    tile_row_decode(src[0], src[1], FALSE, dst);
+    src += TILE_ROW_BYTES;
+    dst += TILE_DATA_TEXTURE_WIDTH;
+  }
+}
+
 void emulator_get_tile_data(Emulator* e, TileData out_tile_data) {
-  assert((TILE_DATA_TEXTURE_WIDTH % TILE_WIDTH) == 0);
-  assert((TILE_DATA_TEXTURE_HEIGHT % TILE_HEIGHT) == 0);
-  const int banks = 2;
-  const int tw = TILE_DATA_TEXTURE_WIDTH / TILE_WIDTH;
-  const int th = TILE_DATA_TEXTURE_HEIGHT / TILE_HEIGHT / banks;
-  int bank, tx, ty, mx, my;
-  MaskedAddress addr = 0;
-  for (bank = 0; bank < banks; ++bank) {
-    addr = bank * 0x2000;
-    for (ty = 0; ty < th; ++ty) {
-      for (tx = 0; tx < tw; ++tx) {
-        int offset =
-            (((bank * th) + ty) * TILE_HEIGHT) * TILE_DATA_TEXTURE_WIDTH +
-            (tx * TILE_WIDTH);
-        for (my = 0; my < TILE_HEIGHT; ++my) {
-          for (mx = 0; mx < TILE_WIDTH; ++mx) {
-            u8 lo = e->state.vram.data[addr];
-            u8 hi = e->state.vram.data[addr + 1];
-            u8 shift = 7 - (mx & 7);
-            u8 palette_index = (((hi >> shift) & 1) << 1) | ((lo >> shift) & 1);
-            out_tile_data[offset + mx] = palette_index;
-          }
-          addr += TILE_ROW_BYTES;
-          offset += TILE_DATA_TEXTURE_WIDTH;
-        }
+  int tile;
+  for (tile = 0; tile < TILE_DATA_TILE_COUNT; ++tile) {
+    decode_tile(e, tile, out_tile_data);
+  }
+}
+
+u32 emulator_update_tile_data(Emulator* e, TileData out_tile_data) {
+  u32* dirty_tiles = e->debug->dirty_tiles;
+  u32 dirty_rows = 0;
+  int word, bit;
+  for (word = 0; word < (int)ARRAY_SIZE(e->debug->dirty_tiles); ++word) {
+    u32 bits = dirty_tiles[word];
+    if (bits == 0) {
+      continue;
+    }
+    for (bit = 0; bit < 32; ++bit) {
+      if (bits & (1u << bit)) {
+        int tile = word * 32 + bit;
+        decode_tile(e, tile, out_tile_data);
+        dirty_rows |= 1u << (tile / TILE_DATA_ROW_TILES);
       }
     }
+    dirty_tiles[word] = 0;
   }
+  return dirty_rows;
 }
 
 void emulator_get_tile_map(Emulator* e, TileMapSelect map_select,
@@ -59,9 +59,16 @@ typedef enum {
   ROM_USAGE_CODE_START = 4, /* Start of an opcode. */
 } RomUsage;
 
+#define ROM_USAGE_VALUES 8 /* Every combination of RomUsage bits. */
+/* Changes to ROM usage are tracked in blocks of this many bytes. */
+#define ROM_USAGE_BLOCK_SIZE 128
+
 #define TILE_DATA_TEXTURE_WIDTH 256
 #define TILE_DATA_TEXTURE_HEIGHT 192
 typedef u8 TileData[TILE_DATA_TEXTURE_WIDTH * TILE_DATA_TEXTURE_HEIGHT];
+/* 384 tiles of each VRAM bank, in rows of 32; bank 0's rows come first. */
+#define TILE_DATA_ROW_TILES 32
+#define TILE_DATA_ROWS 24
 
 #define TILE_MAP_WIDTH 32
 #define TILE_MAP_HEIGHT 32
@@ -91,33 +98,54 @@ typedef struct {
   unsigned hit : 1;
 } Breakpoint;
 
-void emulator_set_log_level(LogSystem, LogLevel);
-SetLogLevelError emulator_set_log_level_from_string(const char*);
-Bool emulator_get_trace();
-void emulator_set_trace(Bool trace);
-void emulator_push_trace(Bool trace);
-void emulator_pop_trace();
+/* All of the breakpoint, trace, logging, ROM usage and profiling state lives
+ * in an EmulatorDebug context. Every Emulator creates its own context, which
+ * can be replaced by attaching another one with emulator_set_debug; the
+ * caller keeps ownership of an attached context. Passing NULL reattaches the
+ * Emulator's own context. A context can also be created and configured before
+ * the Emulator exists, then attached at creation with EmulatorInit.debug. */
+typedef struct EmulatorDebug EmulatorDebug;
+
+EmulatorDebug* emulator_debug_new(void);
+void emulator_debug_delete(EmulatorDebug*);
+void emulator_set_debug(Emulator*, EmulatorDebug*);
+EmulatorDebug* emulator_get_debug(Emulator*);
+
+void emulator_set_log_level(EmulatorDebug*, LogSystem, LogLevel);
+SetLogLevelError emulator_set_log_level_from_string(EmulatorDebug*,
+                                                    const char*);
+Bool emulator_get_trace(EmulatorDebug*);
+void emulator_set_trace(EmulatorDebug*, Bool trace);
+void emulator_push_trace(EmulatorDebug*, Bool trace);
+void emulator_pop_trace(EmulatorDebug*);
 const char* emulator_get_log_system_name(LogSystem);
-LogLevel emulator_get_log_level(LogSystem);
+LogLevel emulator_get_log_level(EmulatorDebug*, LogSystem);
 void emulator_print_log_systems();
 
 Bool emulator_is_cgb(Emulator*);
 Bool emulator_is_sgb(Emulator*);
 
 int emulator_get_rom_size(Emulator*);
-Bool emulator_get_rom_usage_enabled(void);
-void emulator_set_rom_usage_enabled(Bool enable);
-u8* emulator_get_rom_usage(void);
-void emulator_clear_rom_usage(void);
-
-Bool emulator_get_opcode_count_enabled(void);
-void emulator_set_opcode_count_enabled(Bool enable);
-u32* emulator_get_opcode_count(void);
-u32* emulator_get_cb_opcode_count(void);
-
-Bool emulator_get_profiling_enabled(void);
-void emulator_set_profiling_enabled(Bool enable);
-u32* emulator_get_profiling_counters(void);
+Bool emulator_get_rom_usage_enabled(EmulatorDebug*);
+void emulator_set_rom_usage_enabled(EmulatorDebug*, Bool enable);
+u8* emulator_get_rom_usage(EmulatorDebug*);
+void emulator_clear_rom_usage(EmulatorDebug*);
+/* The number of ROM bytes with each ROM usage value. Unused bytes (value 0)
+ * are not counted. */
+const u32* emulator_get_rom_usage_counts(EmulatorDebug*);
+/* Find the first run of ROM usage blocks at or after |*begin| that changed
+ * since they were last returned, and mark them unchanged. Returns FALSE if
+ * there are none, otherwise [*begin, *end) is the run in bytes. */
+Bool emulator_get_next_rom_usage_change(EmulatorDebug*, u32* begin, u32* end);
+
+Bool emulator_get_opcode_count_enabled(EmulatorDebug*);
+void emulator_set_opcode_count_enabled(EmulatorDebug*, Bool enable);
+u32* emulator_get_opcode_count(EmulatorDebug*);
+u32* emulator_get_cb_opcode_count(EmulatorDebug*);
+
+Bool emulator_get_profiling_enabled(EmulatorDebug*);
+void emulator_set_profiling_enabled(EmulatorDebug*, Bool enable);
+u32* emulator_get_profiling_counters(EmulatorDebug*);
 
 void emulator_get_opcode_mnemonic(u16 opcode, char* buffer, size_t size);
 int emulator_disassemble(Emulator*, Address, char* buffer, size_t size);
@@ -125,14 +153,15 @@ void emulator_disassemble_rom(Emulator*, u32 rom_addr, char* buffer,
                               size_t size);
 Registers emulator_get_registers(Emulator*);
 
-int emulator_get_max_breakpoint_id(void);
-Breakpoint emulator_get_breakpoint(int id);
+/* Breakpoints are stored in the attached EmulatorDebug context. */
+int emulator_get_max_breakpoint_id(Emulator*);
+Breakpoint emulator_get_breakpoint(Emulator*, int id);
 Breakpoint emulator_get_breakpoint_by_address(Emulator*, Address addr);
-int emulator_add_empty_breakpoint(void);
+int emulator_add_empty_breakpoint(Emulator*);
 int emulator_add_breakpoint(Emulator*, Address, Bool enabled);
 void emulator_set_breakpoint_address(Emulator*, int id, Address);
-void emulator_enable_breakpoint(int id, Bool enabled);
-void emulator_remove_breakpoint(int id);
+void emulator_enable_breakpoint(Emulator*, int id, Bool enabled);
+void emulator_remove_breakpoint(Emulator*, int id);
 
 int emulator_get_rom_bank(Emulator*, Address);
 
@@ -146,6 +175,11 @@ PaletteRGBA emulator_get_palette_rgba(Emulator*, PaletteType);
 PaletteRGBA emulator_get_cgb_palette_rgba(Emulator*, CgbPaletteType, int index);
 PaletteRGBA emulator_get_sgb_palette_rgba(Emulator*, int index);
 void emulator_get_tile_data(Emulator*, TileData);
+/* Like emulator_get_tile_data, but only decodes the tiles written since the
+ * previous call. Everything is decoded after the debug context is attached,
+ * or after a state is loaded. Returns a bitmask of the rows of tiles that
+ * changed, bit 0 for the top row. */
+u32 emulator_update_tile_data(Emulator*, TileData);
 void emulator_get_tile_map(Emulator*, TileMapSelect, TileMap);
 void emulator_get_tile_map_attr(Emulator*, TileMapSelect, TileMap);
 void emulator_get_sgb_attr_map(Emulator*, u8[90]);
@@ -5,11 +5,23 @@
  * of the MIT license.  See the LICENSE file for details.
  */
 #include <assert.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "emulator.h"
+#include "tile-decode.h"
+
+#ifdef BINJGB_PROFILE
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#elif defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#else
+#include <time.h>
+#endif
+#endif
 
 #define MAX_CART_INFOS (MAXIMUM_ROM_SIZE / MINIMUM_ROM_SIZE)
 #define VIDEO_RAM_SIZE KILOBYTES(16)
@@ -20,6 +32,12 @@
 
 #define OBJ_PER_LINE_COUNT 10
 
+/* Longest polling loop that idle_fast_forward recognizes, in bytes. */
+#define IDLE_LOOP_MAX_LENGTH 7
+
+/* Deepest nesting of subsystems timed with PROFILE_BEGIN. */
+#define PROFILE_MAX_DEPTH 16
+
 /* Addresses are relative to IO_START_ADDR (0xff00). */
 #define FOREACH_IO_REG(V)                           \
   V(JOYP, 0x00)  /* Joypad */                       \
@@ -690,17 +708,64 @@ typedef struct {
 
 const size_t s_emulator_state_size = sizeof(EmulatorState);
 
-struct Emulator {
-  EmulatorConfig config;
+/* Output stage for AUDIO_FORMAT_S16 and AUDIO_FORMAT_F32. Every change of a
+ * channel's contribution to an output is added to |deltas| as a band-limited
+ * step at its exact tick; emulator_run_until then integrates the deltas into
+ * output frames. */
+typedef struct {
+  s32* deltas; /* 2-channel, indexed by output frame from |base|. */
+  u64 base;    /* Time of deltas[0], in ticks * frequency. */
+  s32 level[APU_CHANNEL_COUNT][SOUND_OUTPUT_COUNT]; /* Last added level. */
+  s32 sum[SOUND_OUTPUT_COUNT]; /* Integral of the rendered deltas. */
+  f32 highpass_in[SOUND_OUTPUT_COUNT];
+  f32 highpass_out[SOUND_OUTPUT_COUNT];
+  f32 highpass_charge; /* Per output frame. */
+  f32 volume;
+} Blep;
+
+/* emulator-debug.c defines this to add its per-instance state. */
+#ifndef EMULATOR_DEBUG_FIELDS
+#define EMULATOR_DEBUG_FIELDS
+#endif
+
+/* The unread part of each chunk is [begin, end). Chunks are appended at
+ * |tail| and drained from |head|; one drained chunk is kept in |spare| so a
+ * log that is drained every frame doesn't allocate. */
+typedef struct ApuLogChunk {
+  struct ApuLogChunk* next;
+  size_t begin, end;
+  ApuWrite writes[APU_LOG_CHUNK_WRITES];
+} ApuLogChunk;
+
+typedef struct {
+  ApuLogChunk* head;
+  ApuLogChunk* tail;
+  ApuLogChunk* spare;
+  size_t count;
+  Ticks drained_ticks; /* Ticks of the last drained write or state load. */
+} ApuLog;
+
+struct EmulatorRom {
   FileData file_data;
+  FileDataFreeFunc free_file_data; /* NULL if |file_data| is borrowed. */
   CartInfo cart_infos[MAX_CART_INFOS];
   u32 cart_info_count;
+  u8 initial_cart_info_index;
+  int ref_count;
+};
+
+struct Emulator {
+  EmulatorConfig config;
+  EmulatorRom* rom;
   CartInfo* cart_info; /* Cached for convenience. */
   MemoryMap memory_map;
   EmulatorState state;
   FrameBuffer frame_buffer;
   SgbFrameBuffer sgb_frame_buffer;
+  /* Pixels are written here instead when the SGB mask is active. */
+  RGBA dummy_frame_buffer_line[SCREEN_WIDTH];
   AudioBuffer audio_buffer;
+  Blep blep; /* Only used if audio_buffer.format isn't AUDIO_FORMAT_U8. */
   JoypadCallbackInfo joypad_info;
   /* color_to_rgba stores mappings from 4 DMG colors to RGBA colors. pal is a
    * cached copy of the current DMG palette (e.g. could be all COLOR_WHITE). */
@@ -709,8 +774,61 @@ struct Emulator {
   PaletteRGBA sgb_pal[4];
   CgbColorCurve cgb_color_curve;
   ApuLog apu_log;
+  /* Set when a short backward JR is taken; see idle_fast_forward. */
+  Bool idle_loop_candidate;
+  /* Pages of |state| written since the last snapshot. Only VRAM, WRAM and
+   * external RAM are tracked; pages holding anything else are in
+   * untracked_state_pages and are always copied. */
+  EmulatorStatePages dirty_state_pages;
+  EmulatorStatePages untracked_state_pages;
+#ifdef BINJGB_PROFILE
+  EmulatorProfile profile;
+  /* Subsystems being timed, innermost last. Nothing is timed at depth 0, i.e.
+   * outside of emulator_run_until. */
+  EmulatorProfileKind profile_stack[PROFILE_MAX_DEPTH];
+  int profile_depth;
+  u64 profile_last_clock; /* When the innermost subsystem was last charged. */
+#endif
+  EMULATOR_DEBUG_FIELDS
 };
 
+#ifdef BINJGB_PROFILE
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || \
+    defined(_M_X64)
+#define PROFILE_CLOCK_UNIT "cycles"
+static inline u64 profile_clock(void) { return __rdtsc(); }
+#else
+#define PROFILE_CLOCK_UNIT "ns"
+static inline u64 profile_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+static void profile_charge(Emulator* e) {
+  u64 now = profile_clock();
+  if (e->profile_depth > 0) {
+    e->profile.clocks[e->profile_stack[e->profile_depth]] +=
+        now - e->profile_last_clock;
+  }
+  e->profile_last_clock = now;
+}
+
+static void profile_begin(Emulator* e, EmulatorProfileKind kind) {
+  profile_charge(e);
+  assert(e->profile_depth + 1 < PROFILE_MAX_DEPTH);
+  e->profile_stack[++e->profile_depth] = kind;
+  e->profile.calls[kind]++;
+}
+
+static void profile_end(Emulator* e) {
+  profile_charge(e);
+  assert(e->profile_depth > 0);
+  e->profile_depth--;
+}
+#endif
+
 
 /* Abbreviations of commonly accessed values. */
 #define APU (e->state.apu)
@@ -750,6 +868,9 @@ struct Emulator {
 #define VALUE_WRAPPED(X, MAX) \
   (UNLIKELY((X) >= (MAX) ? ((X) -= (MAX), TRUE) : FALSE))
 
+#define STATE_PAGE_COUNT \
+  DIV_CEIL(sizeof(EmulatorState), EMULATOR_STATE_PAGE_SIZE)
+
 #define SAVE_STATE_VERSION (2)
 #define SAVE_STATE_HEADER (u32)(0x6b57a7e0 + SAVE_STATE_VERSION)
 
@@ -765,6 +886,16 @@ struct Emulator {
 #define HOOK0_FALSE(name) FALSE
 #endif
 
+/* Like the HOOK macros, these compile to nothing unless BINJGB_PROFILE is
+ * defined. Every PROFILE_BEGIN must be matched by a PROFILE_END. */
+#ifdef BINJGB_PROFILE
+#define PROFILE_BEGIN(kind) profile_begin(e, EMULATOR_PROFILE_##kind)
+#define PROFILE_END() profile_end(e)
+#else
+#define PROFILE_BEGIN(kind)
+#define PROFILE_END()
+#endif
+
 /* ROM header stuff */
 #define LOGO_START_ADDR 0x104
 #define LOGO_END_ADDR 0x133
@@ -859,6 +990,17 @@ struct Emulator {
  * of the slowest instruction. */
 #define AUDIO_BUFFER_EXTRA_FRAMES 256
 
+/* Band-limited step synthesis, for AUDIO_FORMAT_S16 and AUDIO_FORMAT_F32. See
+ * scripts/blep_kernel.py. */
+#define BLEP_PHASE_COUNT 32
+#define BLEP_WIDTH 16
+#define BLEP_UNIT_BITS 15
+/* Largest level of one output: every channel at 15, master volume at 8. */
+#define BLEP_MAX_LEVEL \
+  (APU_CHANNEL_COUNT * ENVELOPE_MAX_VOLUME * (SOUND_OUTPUT_MAX_VOLUME + 1))
+/* Per-tick charge factor of the high-pass filter on the GB's audio output. */
+#define BLEP_HIGHPASS_CHARGE_PER_TICK 0.999958
+
 #define WAVE_TRIGGER_CORRUPTION_OFFSET_TICKS APU_TICKS
 #define WAVE_TRIGGER_DELAY_TICKS (3 * APU_TICKS)
 
@@ -1026,6 +1168,7 @@ static u8 s_obj_size_to_height[] = {[OBJ_SIZE_8X8] = 8, [OBJ_SIZE_8X16] = 16};
 
 static Result init_memory_map(Emulator*);
 static void apu_synchronize(Emulator*);
+static void apu_blep_update(Emulator*);
 static void dma_synchronize(Emulator*);
 static void intr_synchronize(Emulator*);
 static void ppu_synchronize(Emulator*);
@@ -1035,6 +1178,16 @@ static void timer_synchronize(Emulator*);
 static void calculate_next_ppu_intr(Emulator*);
 static void calculate_next_serial_intr(Emulator*);
 
+static void mark_state_dirty(Emulator* e, const void* p) {
+  size_t page = ((const u8*)p - (const u8*)&e->state) /
+                EMULATOR_STATE_PAGE_SIZE;
+  e->dirty_state_pages.bits[page >> 5] |= 1u << (page & 31);
+}
+
+static void mark_all_state_dirty(Emulator* e) {
+  memset(&e->dirty_state_pages, 0xff, sizeof(e->dirty_state_pages));
+}
+
 static MemoryTypeAddressPair make_pair(MemoryMapType type, Address addr) {
   MemoryTypeAddressPair result;
   result.type = type;
@@ -1107,7 +1260,7 @@ static MemoryTypeAddressPair map_hdma_source_address(Address addr) {
 
 static void set_cart_info(Emulator* e, u8 index) {
   e->state.cart_info_index = index;
-  e->cart_info = &e->cart_infos[index];
+  e->cart_info = &e->rom->cart_infos[index];
   if (!(e->cart_info->data && SUCCESS(init_memory_map(e)))) {
     UNREACHABLE("Unable to switch cart (%d).\n", index);
   }
@@ -1159,29 +1312,29 @@ static Result get_cart_info(FileData* file_data, size_t offset,
   ON_ERROR_RETURN;
 }
 
-static Result get_cart_infos(Emulator* e) {
+static Result get_cart_infos(EmulatorRom* rom) {
   u32 i;
   for (i = 0; i < MAX_CART_INFOS; ++i) {
     size_t offset = i << CART_INFO_SHIFT;
-    if (offset + MINIMUM_ROM_SIZE > e->file_data.size) break;
-    if (SUCCESS(
-            get_cart_info(&e->file_data, offset, &e->cart_infos[i], TRUE))) {
-      if (s_cart_type_info[e->cart_infos[i].cart_type].mbc_type ==
+    if (offset + MINIMUM_ROM_SIZE > rom->file_data.size) break;
+    if (SUCCESS(get_cart_info(&rom->file_data, offset, &rom->cart_infos[i],
+                              TRUE))) {
+      if (s_cart_type_info[rom->cart_infos[i].cart_type].mbc_type ==
           MBC_TYPE_MMM01) {
         /* MMM01 has the cart header at the end. */
-        set_cart_info(e, i);
+        rom->initial_cart_info_index = i;
         return OK;
       }
-      e->cart_info_count++;
+      rom->cart_info_count++;
     }
   }
   // Maybe the logo checksum failed; try again without it required.
-  if (e->cart_info_count == 0 &&
-      SUCCESS(get_cart_info(&e->file_data, 0, &e->cart_infos[0], FALSE))) {
-    e->cart_info_count++;
+  if (rom->cart_info_count == 0 &&
+      SUCCESS(get_cart_info(&rom->file_data, 0, &rom->cart_infos[0], FALSE))) {
+    rom->cart_info_count++;
   }
-  CHECK_MSG(e->cart_info_count != 0, "Invalid ROM.\n");
-  set_cart_info(e, 0);
+  CHECK_MSG(rom->cart_info_count != 0, "Invalid ROM.\n");
+  rom->initial_cart_info_index = 0;
   return OK;
   ON_ERROR_RETURN;
 }
@@ -1224,6 +1377,7 @@ static void gb_write_ext_ram(Emulator* e, MaskedAddress addr, u8 value) {
   if (MMAP_STATE.ext_ram_enabled) {
     assert(addr <= ADDR_MASK_8K);
     EXT_RAM.data[MMAP_STATE.ext_ram_base | addr] = value;
+    mark_state_dirty(e, &EXT_RAM.data[MMAP_STATE.ext_ram_base | addr]);
     e->state.ext_ram_updated = TRUE;
   } else {
     HOOK(write_ram_disabled_ab, addr, value);
@@ -1307,6 +1461,7 @@ static u8 mbc2_read_ram(Emulator* e, MaskedAddress addr) {
 static void mbc2_write_ram(Emulator* e, MaskedAddress addr, u8 value) {
   if (MMAP_STATE.ext_ram_enabled) {
     EXT_RAM.data[addr & MBC2_RAM_ADDR_MASK] = value & MBC2_RAM_VALUE_MASK;
+    mark_state_dirty(e, &EXT_RAM.data[addr & MBC2_RAM_ADDR_MASK]);
   } else {
     HOOK(write_ram_disabled_ab, addr, value);
   }
@@ -1581,7 +1736,7 @@ static Result init_memory_map(Emulator* e) {
       memory_map->write_rom = dummy_write;
       break;
     case MBC_TYPE_MBC1: {
-      Bool is_mbc1m = e->cart_info_count > 1;
+      Bool is_mbc1m = e->rom->cart_info_count > 1;
       memory_map->write_rom = is_mbc1m ? mbc1m_write_rom : mbc1_write_rom;
       break;
     }
@@ -1996,6 +2151,8 @@ static void write_vram(Emulator* e, MaskedAddress addr, u8 value) {
 
   assert(addr <= ADDR_MASK_8K);
   VRAM.data[VRAM.offset + addr] = value;
+  mark_state_dirty(e, &VRAM.data[VRAM.offset + addr]);
+  HOOK(write_vram_i, VRAM.offset + addr);
 }
 
 static void write_oam_no_mode_check(Emulator* e, MaskedAddress addr, u8 value) {
@@ -2041,6 +2198,7 @@ static void increment_tima(Emulator*);
 
 static void timer_synchronize(Emulator* e) {
   if (TICKS > TIMER.sync_ticks) {
+    PROFILE_BEGIN(TIMER);
     Ticks delta_ticks = TICKS - TIMER.sync_ticks;
     TIMER.sync_ticks = TICKS;
 
@@ -2063,6 +2221,7 @@ static void timer_synchronize(Emulator* e) {
     } else {
       TIMER.div_counter += delta_ticks;
     }
+    PROFILE_END();
   }
 }
 
@@ -2381,6 +2540,7 @@ static void do_sgb(Emulator* e) {
       // the upper-left tile and assuming that the rest of the data is in
       // order.
       int code = SGB.data[0] >> 3;
+      u8 temp_xfer_buffer[4096];
       u8* xfer_src = NULL;
       if (code == 0x0b || code == 0x13 || code == 0x14 || code == 0x15) {
         u16 map_base = map_select_to_address(LCDC.bg_tile_map_select);
@@ -2388,12 +2548,11 @@ static void do_sgb(Emulator* e) {
         if (LCDC.bg_tile_data_select == TILE_DATA_8800_97FF) {
           // Copy the data into the temporary buffer so it can be used
           // contiguously.
-          static u8 s_temp_xfer_buffer[4096];
           u16 start_offset = (256 + (s8)tile_index) * 16;
           u16 len = 0x1800 - start_offset;
-          memcpy(s_temp_xfer_buffer, VRAM.data + start_offset, len);
-          memcpy(s_temp_xfer_buffer + len, VRAM.data + 0x800, 0x1000 - len);
-          xfer_src = s_temp_xfer_buffer;
+          memcpy(temp_xfer_buffer, VRAM.data + start_offset, len);
+          memcpy(temp_xfer_buffer + len, VRAM.data + 0x800, 0x1000 - len);
+          xfer_src = temp_xfer_buffer;
         } else {
           xfer_src = VRAM.data + tile_index * 16;
         }
@@ -3025,13 +3184,39 @@ static void write_noise_period(Emulator* e) {
   HOOK(write_noise_period_info_iii, divisor, NOISE.clock_shift, NOISE.period);
 }
 
+static void apu_log_append(Emulator* e, MaskedAddress addr, u8 value) {
+  ApuLog* log = &e->apu_log;
+  ApuLogChunk* chunk = log->tail;
+  if (!chunk || chunk->end == APU_LOG_CHUNK_WRITES) {
+    if (log->spare) {
+      chunk = log->spare;
+      log->spare = NULL;
+    } else {
+      chunk = xmalloc(sizeof(ApuLogChunk));
+      if (!chunk) {
+        return;
+      }
+    }
+    chunk->next = NULL;
+    chunk->begin = chunk->end = 0;
+    if (log->tail) {
+      log->tail->next = chunk;
+    } else {
+      log->head = chunk;
+    }
+    log->tail = chunk;
+  }
+  ApuWrite* write = &chunk->writes[chunk->end++];
+  ZERO_MEMORY(*write);
+  write->ticks = TICKS;
+  write->addr = addr;
+  write->value = value;
+  log->count++;
+}
+
 static void write_apu(Emulator* e, MaskedAddress addr, u8 value) {
   if (e->config.log_apu_writes || !APU.initialized) {
-    if (e->apu_log.write_count < MAX_APU_LOG_FRAME_WRITES) {
-      ApuWrite* write = &e->apu_log.writes[e->apu_log.write_count++];
-      write->addr = addr;
-      write->value = value;
-    }
+    apu_log_append(e, addr, value);
   }
 
   if (!APU.enabled) {
@@ -3213,6 +3398,10 @@ static void write_apu(Emulator* e, MaskedAddress addr, u8 value) {
       break;
     }
   }
+
+  if (APU.initialized) {
+    apu_blep_update(e);
+  }
 }
 
 static void write_wave_ram(Emulator* e, MaskedAddress addr, u8 value) {
@@ -3247,9 +3436,11 @@ static void write_u8_pair(Emulator* e, MemoryTypeAddressPair pair, u8 value) {
       break;
     case MEMORY_MAP_WORK_RAM0:
       WRAM.data[pair.addr] = value;
+      mark_state_dirty(e, &WRAM.data[pair.addr]);
       break;
     case MEMORY_MAP_WORK_RAM1:
       WRAM.data[WRAM.offset + pair.addr] = value;
+      mark_state_dirty(e, &WRAM.data[WRAM.offset + pair.addr]);
       break;
     case MEMORY_MAP_OAM:
       write_oam(e, pair.addr, value);
@@ -3345,11 +3536,253 @@ static u32 mode3_tick_count(Emulator* e) {
   return ticks;
 }
 
+/* Fetches and decodes one row of a BG or window tile into palette indices,
+ * leftmost pixel first. screen_x is used to look up the SGB attribute; it is
+ * the X coordinate at which the tile is fetched, not where the tile starts. */
+static PaletteRGBA* fetch_bg_tile_row(Emulator* e, u16 map_addr,
+                                      TileDataSelect data_select, u8 my,
+                                      u8 screen_x,
+                                      u8 out_row[TILE_ROW_PIXELS],
+                                      Bool* out_priority) {
+  PaletteRGBA* pal;
+  u16 tile_index = VRAM.data[map_addr];
+  u8 my7 = my & 7;
+  if (data_select == TILE_DATA_8800_97FF) {
+    tile_index = 256 + (s8)tile_index;
+  }
+  if (IS_CGB) {
+    u8 attr = VRAM.data[0x2000 + map_addr];
+    pal = &PPU.bgcp.palettes[attr & 0x7];
+    if (attr & 0x08) { tile_index += 0x200; }
+    if (attr & 0x40) { my7 = 7 - my7; }
+    *out_priority = (attr & 0x80) != 0;
+    u16 tile_addr = (tile_index * TILE_HEIGHT + my7) * TILE_ROW_BYTES;
+    tile_row_decode(VRAM.data[tile_addr], VRAM.data[tile_addr + 1],
+                    (attr & 0x20) != 0, out_row);
+  } else {
+    if (IS_SGB) {
+      int idx = (PPU.line_y >> 3) * (SCREEN_WIDTH >> 3) + (screen_x >> 3);
+      u8 palidx = (SGB.attr_map[idx >> 2] >> (2 * (3 - (idx & 3)))) & 3;
+      pal = &e->sgb_pal[palidx];
+    } else {
+      pal = &e->pal[PALETTE_TYPE_BGP];
+    }
+    *out_priority = FALSE;
+    u16 tile_addr = (tile_index * TILE_HEIGHT + my7) * TILE_ROW_BYTES;
+    tile_row_decode(VRAM.data[tile_addr], VRAM.data[tile_addr + 1], FALSE,
+                    out_row);
+  }
+  return pal;
+}
+
+/* Fetches and decodes the row of an object at oy (relative to the top of the
+ * object), leftmost pixel first. */
+static PaletteRGBA* fetch_obj_tile_row(Emulator* e, Obj* o, u8 oy,
+                                       u8 obj_height,
+                                       u8 out_row[TILE_ROW_PIXELS]) {
+  if (o->yflip) {
+    oy = obj_height - 1 - oy;
+  }
+
+  u16 tile_index = o->tile;
+  if (obj_height == 16) {
+    if (oy < 8) {
+      /* Top tile of 8x16 sprite. */
+      tile_index &= 0xfe;
+    } else {
+      /* Bottom tile of 8x16 sprite. */
+      tile_index |= 0x01;
+      oy -= 8;
+    }
+  }
+  PaletteRGBA* pal = NULL;
+  if (IS_CGB) {
+    pal = &PPU.obcp.palettes[o->cgb_palette & 0x7];
+    if (o->bank) { tile_index += 0x200; }
+  } else {
+    pal = &e->pal[o->palette + 1];
+  }
+  u16 tile_addr = (tile_index * TILE_HEIGHT + (oy & 7)) * TILE_ROW_BYTES;
+  tile_row_decode(VRAM.data[tile_addr], VRAM.data[tile_addr + 1], o->xflip,
+                  out_row);
+  return pal;
+}
+
+static RGBA* get_render_line(Emulator* e, u8 x) {
+  if (SGB.mask != SGB_MASK_CANCEL) {
+    return e->dummy_frame_buffer_line + x;
+  } else {
+    return &e->frame_buffer[PPU.line_y * SCREEN_WIDTH + x];
+  }
+}
+
+static RGBA get_blank_bg_color(Emulator* e) {
+  if (IS_CGB) {
+    return PPU.bgcp.palettes[0].color[0];
+  } else if (IS_SGB) {
+    return e->sgb_pal[0].color[0];
+  } else {
+    return e->color_to_rgba[0].color[0];
+  }
+}
+
+/* Renders an entire line in one pass. This is used when nothing has been
+ * rendered yet on this line and the whole line is due, which means there
+ * were no mid-line writes to registers that affect rendering. The output is
+ * identical to rendering the line 4 pixels at a time, but BG tiles are
+ * expanded a row at a time and each object is composited once instead of
+ * being tested against every group of 4 pixels. */
+static void ppu_mode3_render_line(Emulator* e) {
+  const u8 y = PPU.line_y;
+  Bool display_bg = (IS_CGB || LCDC.bg_display) && !e->config.disable_bg;
+  const Bool display_obj = LCDC.obj_display && !e->config.disable_obj;
+  int window_x = SCREEN_WIDTH; /* First pixel of the window, if any. */
+  if (PPU.rendering_window) {
+    window_x = 0;
+  } else if (LCDC.window_display && !e->config.disable_window &&
+             PPU.wx <= WINDOW_MAX_X && y >= PPU.wy) {
+    window_x = MAX(0, PPU.wx - WINDOW_X_OFFSET);
+  }
+
+  const TileDataSelect data_select = LCDC.bg_tile_data_select;
+  RGBA* pixel = get_render_line(e, 0);
+  Bool bg_is_zero[SCREEN_WIDTH], bg_priority[SCREEN_WIDTH];
+
+  /* The BG runs from 0 to window_x, then the window runs to the end of the
+   * line. */
+  u8 mx = PPU.scx;
+  u8 my = PPU.scy + y;
+  u16 map_base = map_select_to_address(LCDC.bg_tile_map_select);
+  int x = 0;
+  int span;
+  for (span = 0; span < 2; ++span) {
+    int end = span == 0 ? window_x : SCREEN_WIDTH;
+    if (span == 1) {
+      if (window_x >= SCREEN_WIDTH) {
+        break;
+      }
+      PPU.rendering_window = display_bg = TRUE;
+      mx = x + WINDOW_X_OFFSET - PPU.wx;
+      my = PPU.win_y;
+      map_base = map_select_to_address(LCDC.window_tile_map_select);
+    }
+    map_base |= (my >> 3) * TILE_MAP_WIDTH;
+
+    if (!display_bg) {
+      RGBA color = get_blank_bg_color(e);
+      for (; x < end; ++x) {
+        pixel[x] = color;
+        bg_is_zero[x] = TRUE;
+        bg_priority[x] = FALSE;
+      }
+      continue;
+    }
+
+    while (x < end) {
+      u8 row[TILE_ROW_PIXELS];
+      Bool priority;
+      /* The incremental renderer looks up the SGB attribute at the start of
+       * the current 4 pixel group; match that. */
+      PaletteRGBA* pal = fetch_bg_tile_row(e, map_base | (mx >> 3),
+                                           data_select, my, x & ~3, row,
+                                           &priority);
+      int i = mx & 7;
+      int count = MIN(TILE_ROW_PIXELS - i, end - x);
+      mx += count;
+      if (count == TILE_ROW_PIXELS) {
+        tile_row_to_rgba(row, pal->color, &pixel[x]);
+        for (i = 0; i < TILE_ROW_PIXELS; ++i, ++x) {
+          bg_is_zero[x] = row[i] == 0;
+          bg_priority[x] = priority;
+        }
+        continue;
+      }
+      for (; count > 0; --count, ++x, ++i) {
+        pixel[x] = pal->color[row[i]];
+        bg_is_zero[x] = row[i] == 0;
+        bg_priority[x] = priority;
+      }
+    }
+  }
+
+  /* LCDC bit 0 works differently on cgb; when it's cleared OBJ will always
+   * have priority over bg and window. */
+  if (IS_CGB && !LCDC.bg_display) {
+    for (x = 0; x < SCREEN_WIDTH; ++x) {
+      bg_is_zero[x] = TRUE;
+      bg_priority[x] = FALSE;
+    }
+  }
+
+  if (display_obj) {
+    u8 obj_height = s_obj_size_to_height[LCDC.obj_size];
+    int n;
+    /* Draw in reverse so lower-indexed objects are drawn on top. */
+    for (n = PPU.line_obj_count - 1; n >= 0; --n) {
+      Obj* o = &PPU.line_obj[n];
+      u8 oy = y - o->y;
+      if (oy >= obj_height) {
+        continue;
+      }
+      u8 row[TILE_ROW_PIXELS];
+      PaletteRGBA* pal = fetch_obj_tile_row(e, o, oy, obj_height, row);
+      int i;
+      for (i = 0; i < TILE_ROW_PIXELS; ++i) {
+        u8 ox = o->x + i; /* Wraps at 256, like the hardware. */
+        if (ox >= SCREEN_WIDTH) {
+          continue;
+        }
+        u8 palette_index = row[i];
+        if (palette_index != 0 && (!bg_priority[ox] || bg_is_zero[ox]) &&
+            (o->priority == OBJ_PRIORITY_ABOVE_BG || bg_is_zero[ox])) {
+          pixel[ox] = pal->color[palette_index];
+        }
+      }
+    }
+  }
+}
+
+/* Advances mode 3 like ppu_mode3_synchronize, but without writing any
+ * pixels. Only whether the window was reached on this line is kept, since
+ * that decides which window line is drawn next. */
+static void ppu_mode3_skip(Emulator* e) {
+  u8 x = PPU.render_x;
+  if (PPU.mode3_render_ticks >= TICKS) {
+    return;
+  }
+  u32 groups = (u32)DIV_CEIL(TICKS - PPU.mode3_render_ticks, CPU_TICK);
+  groups = MIN(groups, (u32)(SCREEN_WIDTH - x) / 4);
+  u8 end_x = x + groups * 4;
+  if (!PPU.rendering_window && LCDC.window_display &&
+      !e->config.disable_window && PPU.wx <= WINDOW_MAX_X &&
+      PPU.line_y >= PPU.wy && MAX(0, PPU.wx - WINDOW_X_OFFSET) < end_x) {
+    PPU.rendering_window = TRUE;
+  }
+  PPU.mode3_render_ticks += groups * CPU_TICK;
+  PPU.render_x = end_x;
+}
+
 static void ppu_mode3_synchronize(Emulator* e) {
   u8 x = PPU.render_x;
   const u8 y = PPU.line_y;
   if (STAT.mode != PPU_MODE_MODE3 || x >= SCREEN_WIDTH) return;
 
+  PROFILE_BEGIN(PPU_MODE3);
+  if (UNLIKELY(e->config.skip_render)) {
+    ppu_mode3_skip(e);
+    PROFILE_END();
+    return;
+  }
+
+  if (x == 0 &&
+      PPU.mode3_render_ticks + (SCREEN_WIDTH / 4 - 1) * CPU_TICK < TICKS) {
+    ppu_mode3_render_line(e);
+    PPU.mode3_render_ticks += (SCREEN_WIDTH / 4) * CPU_TICK;
+    PPU.render_x = SCREEN_WIDTH;
+    PROFILE_END();
+    return;
+  }
+
   Bool display_bg = (IS_CGB || LCDC.bg_display) && !e->config.disable_bg;
   const Bool display_obj = LCDC.obj_display && !e->config.disable_obj;
   Bool rendering_window = PPU.rendering_window;
@@ -3364,18 +3797,12 @@ static void ppu_mode3_synchronize(Emulator* e) {
   u8 my = PPU.scy + y;
   u16 map_base = map_select_to_address(LCDC.bg_tile_map_select) |
                  ((my >> 3) * TILE_MAP_WIDTH);
-  RGBA* pixel;
-  if (SGB.mask != SGB_MASK_CANCEL) {
-    static RGBA s_dummy_frame_buffer_line[SCREEN_WIDTH];
-    pixel = s_dummy_frame_buffer_line;
-  } else {
-    pixel = &e->frame_buffer[y * SCREEN_WIDTH + x];
-  }
+  RGBA* pixel = get_render_line(e, x);
 
   /* Cache map_addr info. */
   u16 map_addr = 0;
   PaletteRGBA* pal = NULL;
-  u8 lo = 0, hi = 0;
+  u8 bg_row[TILE_ROW_PIXELS];
 
   Bool priority = FALSE;
   int i;
@@ -3395,58 +3822,17 @@ static void ppu_mode3_synchronize(Emulator* e) {
       }
       if (display_bg) {
         u16 new_map_addr = map_base | (mx >> 3);
-        if (map_addr == new_map_addr) {
-          lo <<= 1;
-          hi <<= 1;
-        } else {
+        if (map_addr != new_map_addr) {
           map_addr = new_map_addr;
-          u16 tile_index = VRAM.data[map_addr];
-          u8 my7 = my & 7;
-          if (data_select == TILE_DATA_8800_97FF) {
-            tile_index = 256 + (s8)tile_index;
-          }
-          if (IS_CGB) {
-            u8 attr = VRAM.data[0x2000 + map_addr];
-            pal = &PPU.bgcp.palettes[attr & 0x7];
-            if (attr & 0x08) { tile_index += 0x200; }
-            if (attr & 0x40) { my7 = 7 - my7; }
-            priority = (attr & 0x80) != 0;
-            u16 tile_addr = (tile_index * TILE_HEIGHT + my7) * TILE_ROW_BYTES;
-            lo = VRAM.data[tile_addr];
-            hi = VRAM.data[tile_addr + 1];
-            if (attr & 0x20) {
-              lo = reverse_bits_u8(lo);
-              hi = reverse_bits_u8(hi);
-            }
-          } else {
-            if (IS_SGB) {
-              int idx = (y >> 3) * (SCREEN_WIDTH >> 3) + (x >> 3);
-              u8 palidx = (SGB.attr_map[idx >> 2] >> (2 * (3 - (idx & 3)))) & 3;
-              pal = &e->sgb_pal[palidx];
-            } else {
-              pal = &e->pal[PALETTE_TYPE_BGP];
-            }
-            priority = FALSE;
-            u16 tile_addr = (tile_index * TILE_HEIGHT + my7) * TILE_ROW_BYTES;
-            lo = VRAM.data[tile_addr];
-            hi = VRAM.data[tile_addr + 1];
-          }
-          u8 shift = mx & 7;
-          lo <<= shift;
-          hi <<= shift;
+          pal = fetch_bg_tile_row(e, map_addr, data_select, my, x, bg_row,
+                                  &priority);
         }
-        u8 palette_index = ((hi >> 6) & 2) | (lo >> 7);
+        u8 palette_index = bg_row[mx & 7];
         pixel[i] = pal->color[palette_index];
         bg_is_zero[i] = palette_index == 0;
         bg_priority[i] = priority;
       } else {
-        if (IS_CGB) {
-          pixel[i] = PPU.bgcp.palettes[0].color[0];
-        } else if (IS_SGB) {
-          pixel[i] = e->sgb_pal[0].color[0];
-        } else {
-          pixel[i] = e->color_to_rgba[0].color[0];
-        }
+        pixel[i] = get_blank_bg_color(e);
       }
     }
 
@@ -3471,47 +3857,18 @@ static void ppu_mode3_synchronize(Emulator* e) {
           continue;
         }
 
-        if (o->yflip) {
-          oy = obj_height - 1 - oy;
-        }
-
-        u16 tile_index = o->tile;
-        if (obj_height == 16) {
-          if (oy < 8) {
-            /* Top tile of 8x16 sprite. */
-            tile_index &= 0xfe;
-          } else {
-            /* Bottom tile of 8x16 sprite. */
-            tile_index |= 0x01;
-            oy -= 8;
-          }
-        }
-        PaletteRGBA* pal = NULL;
-        if (IS_CGB) {
-          pal = &PPU.obcp.palettes[o->cgb_palette & 0x7];
-          if (o->bank) { tile_index += 0x200; }
-        } else {
-          pal = &e->pal[o->palette + 1];
-        }
-        u16 tile_addr = (tile_index * TILE_HEIGHT + (oy & 7)) * TILE_ROW_BYTES;
-        u8 lo = VRAM.data[tile_addr];
-        u8 hi = VRAM.data[tile_addr + 1];
-        if (!o->xflip) {
-          lo = reverse_bits_u8(lo);
-          hi = reverse_bits_u8(hi);
-        }
+        u8 row[TILE_ROW_PIXELS];
+        PaletteRGBA* pal = fetch_obj_tile_row(e, o, oy, obj_height, row);
 
         int tile_data_offset = MAX(0, -ox_start);
         assert(tile_data_offset >= 0 && tile_data_offset < 8);
-        lo >>= tile_data_offset;
-        hi >>= tile_data_offset;
 
         int start = MAX(0, ox_start);
         assert(start >= 0 && start < 4);
         int end = MIN(3, ox_end); /* end is inclusive. */
         assert(end >= 0 && end < 4);
-        for (i = start; i <= end; ++i, lo >>= 1, hi >>= 1) {
-          u8 palette_index = ((hi & 1) << 1) | (lo & 1);
+        for (i = start; i <= end; ++i) {
+          u8 palette_index = row[tile_data_offset + i - start];
           if (palette_index != 0 && (!bg_priority[i] || bg_is_zero[i]) &&
               (o->priority == OBJ_PRIORITY_ABOVE_BG || bg_is_zero[i])) {
             pixel[i] = pal->color[palette_index];
@@ -3521,12 +3878,14 @@ static void ppu_mode3_synchronize(Emulator* e) {
     }
   }
   PPU.render_x = x;
+  PROFILE_END();
 }
 
 static void ppu_synchronize(Emulator* e) {
   assert(IS_ALIGNED(PPU.sync_ticks, CPU_TICK));
   Ticks aligned_ticks = ALIGN_DOWN(TICKS, CPU_TICK);
   if (aligned_ticks > PPU.sync_ticks) {
+    PROFILE_BEGIN(PPU);
     Ticks delta_ticks = aligned_ticks - PPU.sync_ticks;
 
     if (LCDC.display) {
@@ -3673,6 +4032,7 @@ static void ppu_synchronize(Emulator* e) {
       }
     }
     PPU.sync_ticks = aligned_ticks;
+    PROFILE_END();
   }
 }
 
@@ -3756,7 +4116,116 @@ static void update_envelopes(Emulator* e) {
 #define CHANNELX_SAMPLE(channel, sample) \
   (-(sample) & (channel)->envelope.volume)
 
-static void update_square_wave(Channel* channel, u32 total_frames) {
+static const s16 s_blep_kernel[BLEP_PHASE_COUNT][BLEP_WIDTH] = {
+#include "blep-kernel.def"
+};
+
+static Bool blep_active(Emulator* e) {
+  return e->blep.deltas && !e->config.disable_audio;
+}
+
+static s32 blep_channel_amplitude(Emulator* e, int index) {
+  Channel* channel = &APU.channel[index];
+  if (!APU.enabled || !channel->status) {
+    return 0;
+  }
+  switch (index) {
+    case APU_CHANNEL3: return WAVE.sample_data >> WAVE.volume_shift;
+    case APU_CHANNEL4: return CHANNELX_SAMPLE(channel, NOISE.sample);
+    default: return CHANNELX_SAMPLE(channel, channel->square_wave.sample);
+  }
+}
+
+static void blep_add_step(Emulator* e, Ticks ticks,
+                          const s32 delta[SOUND_OUTPUT_COUNT]) {
+  Blep* blep = &e->blep;
+  u64 time = (u64)ticks * e->audio_buffer.frequency - blep->base;
+  u32 frame = (u32)(time / CPU_TICKS_PER_SECOND);
+  u32 phase =
+      (u32)(time % CPU_TICKS_PER_SECOND * BLEP_PHASE_COUNT / CPU_TICKS_PER_SECOND);
+  assert(frame + BLEP_WIDTH <=
+         e->audio_buffer.frames + AUDIO_BUFFER_EXTRA_FRAMES + BLEP_WIDTH);
+  const s16* kernel = s_blep_kernel[phase];
+  s32* dst = blep->deltas + frame * SOUND_OUTPUT_COUNT;
+  int i;
+  for (i = 0; i < BLEP_WIDTH; ++i) {
+    *dst++ += kernel[i] * delta[0];
+    *dst++ += kernel[i] * delta[1];
+  }
+}
+
+/* Add a step at |ticks| if channel |index|'s output level has changed. */
+static void blep_update_channel(Emulator* e, int index, Ticks ticks) {
+  Blep* blep = &e->blep;
+  s32 amplitude = blep_channel_amplitude(e, index);
+  s32 delta[SOUND_OUTPUT_COUNT];
+  int i;
+  for (i = 0; i < SOUND_OUTPUT_COUNT; ++i) {
+    s32 level = 0;
+    if (!e->config.disable_sound[index] && APU.so_output[index][i]) {
+      level = amplitude * (APU.so_volume[i] + 1);
+    }
+    delta[i] = level - blep->level[index][i];
+    blep->level[index][i] = level;
+  }
+  if (delta[0] || delta[1]) {
+    blep_add_step(e, ticks, delta);
+  }
+}
+
+/* Catch up with changes that aren't made by the channel updates below, e.g.
+ * register writes and the frame sequencer. */
+static void apu_blep_update(Emulator* e) {
+  if (blep_active(e)) {
+    int i;
+    for (i = 0; i < APU_CHANNEL_COUNT; ++i) {
+      blep_update_channel(e, i, APU.sync_ticks);
+    }
+  }
+}
+
+static void apu_blep_render(Emulator* e) {
+  AudioBuffer* buffer = &e->audio_buffer;
+  Blep* blep = &e->blep;
+  u64 now = (u64)APU.sync_ticks * buffer->frequency;
+  u32 frames = (u32)((now - blep->base) / CPU_TICKS_PER_SECOND);
+  assert(buffer->position + frames * buffer->frame_size <= buffer->end);
+  const f32 scale = 1.0f / ((f32)BLEP_MAX_LEVEL * (1 << BLEP_UNIT_BITS));
+  const s32* src = blep->deltas;
+  u32 i;
+  int j;
+  for (i = 0; i < frames; ++i) {
+    f32 sample[SOUND_OUTPUT_COUNT];
+    for (j = 0; j < SOUND_OUTPUT_COUNT; ++j) {
+      blep->sum[j] += *src++;
+      f32 in = blep->sum[j] * scale;
+      f32 out = in - blep->highpass_in[j] +
+                blep->highpass_charge * blep->highpass_out[j];
+      blep->highpass_in[j] = in;
+      blep->highpass_out[j] = out;
+      sample[j] = out * blep->volume;
+    }
+    if (buffer->format == AUDIO_FORMAT_F32) {
+      memcpy(buffer->position, sample, sizeof(sample));
+    } else {
+      s16* dst = (s16*)buffer->position;
+      for (j = 0; j < SOUND_OUTPUT_COUNT; ++j) {
+        dst[j] = (s16)(CLAMP(sample[j], -1.0f, 1.0f) * 32767);
+      }
+    }
+    buffer->position += buffer->frame_size;
+  }
+
+  /* Keep the tails of the steps that extend past the rendered frames. */
+  size_t rendered = frames * SOUND_OUTPUT_COUNT;
+  size_t tail = BLEP_WIDTH * SOUND_OUTPUT_COUNT;
+  memmove(blep->deltas, blep->deltas + rendered, tail * sizeof(s32));
+  memset(blep->deltas + tail, 0, rendered * sizeof(s32));
+  blep->base += (u64)frames * CPU_TICKS_PER_SECOND;
+}
+
+static void update_square_wave(Emulator* e, Channel* channel, Ticks ticks,
+                               u32 total_frames) {
   static u8 duty[WAVE_DUTY_COUNT][DUTY_CYCLE_COUNT] =
       {[WAVE_DUTY_12_5] = {0, 0, 0, 0, 0, 0, 0, 1},
        [WAVE_DUTY_25] = {1, 0, 0, 0, 0, 0, 0, 1},
@@ -3771,17 +4240,22 @@ static void update_square_wave(Channel* channel, u32 total_frames) {
         square->ticks = square->period;
         square->position = (square->position + 1) % DUTY_CYCLE_COUNT;
         square->sample = duty[square->duty][square->position];
+        if (blep_active(e)) {
+          blep_update_channel(e, channel - APU.channel,
+                              ticks + frames * APU_TICKS);
+        }
       } else {
         frames = total_frames;
         square->ticks -= frames * APU_TICKS;
       }
+      ticks += frames * APU_TICKS;
       channel->accumulator += sample * frames;
       total_frames -= frames;
     }
   }
 }
 
-static void update_wave(Emulator* e, u32 apu_ticks, u32 total_frames) {
+static void update_wave(Emulator* e, Ticks ticks, u32 total_frames) {
   if (CHANNEL3.status) {
     while (total_frames) {
       u32 frames = WAVE.ticks / APU_TICKS;
@@ -3789,7 +4263,7 @@ static void update_wave(Emulator* e, u32 apu_ticks, u32 total_frames) {
       u8 sample = WAVE.sample_data >> WAVE.volume_shift;
       if (frames <= total_frames) {
         WAVE.position = (WAVE.position + 1) % WAVE_SAMPLE_COUNT;
-        WAVE.sample_time = apu_ticks + WAVE.ticks;
+        WAVE.sample_time = ticks + WAVE.ticks;
         u8 byte = WAVE.ram[WAVE.position >> 1];
         if ((WAVE.position & 1) == 0) {
           WAVE.sample_data = byte >> 4; /* High nybble. */
@@ -3799,18 +4273,21 @@ static void update_wave(Emulator* e, u32 apu_ticks, u32 total_frames) {
         WAVE.ticks = WAVE.period;
         HOOK(wave_update_position_iii, WAVE.position, WAVE.sample_data,
              WAVE.sample_time);
+        if (blep_active(e)) {
+          blep_update_channel(e, APU_CHANNEL3, ticks + frames * APU_TICKS);
+        }
       } else {
         frames = total_frames;
         WAVE.ticks -= frames * APU_TICKS;
       }
-      apu_ticks += frames * APU_TICKS;
+      ticks += frames * APU_TICKS;
       CHANNEL3.accumulator += sample * frames;
       total_frames -= frames;
     }
   }
 }
 
-static void update_noise(Emulator* e, u32 total_frames) {
+static void update_noise(Emulator* e, Ticks ticks, u32 total_frames) {
   if (CHANNEL4.status) {
     while (total_frames) {
       u32 frames = NOISE.ticks / APU_TICKS;
@@ -3825,6 +4302,9 @@ static void update_noise(Emulator* e, u32 total_frames) {
           }
           NOISE.sample = ~NOISE.lfsr & 1;
           NOISE.ticks = NOISE.period;
+          if (blep_active(e)) {
+            blep_update_channel(e, APU_CHANNEL4, ticks + frames * APU_TICKS);
+          }
         } else {
           frames = total_frames;
           NOISE.ticks -= frames * APU_TICKS;
@@ -3832,6 +4312,7 @@ static void update_noise(Emulator* e, u32 total_frames) {
       } else {
         frames = total_frames;
       }
+      ticks += frames * APU_TICKS;
       CHANNEL4.accumulator += sample * frames;
       total_frames -= frames;
     }
@@ -3854,33 +4335,58 @@ static void write_audio_frame(Emulator* e, u32 gb_frames) {
   buffer->divisor += gb_frames;
   buffer->freq_counter += buffer->frequency * gb_frames;
   if (VALUE_WRAPPED(buffer->freq_counter, APU_TICKS_PER_SECOND)) {
-    for (i = 0; i < SOUND_OUTPUT_COUNT; ++i) {
-      u32 accumulator = 0;
-      for (j = 0; j < APU_CHANNEL_COUNT; ++j) {
-        if (!e->config.disable_sound[j]) {
-          accumulator += APU.channel[j].accumulator * APU.so_output[j][i];
+    /* With band-limited output this only runs for the channel capture. */
+    if (!e->blep.deltas) {
+      for (i = 0; i < SOUND_OUTPUT_COUNT; ++i) {
+        u32 accumulator = 0;
+        for (j = 0; j < APU_CHANNEL_COUNT; ++j) {
+          if (!e->config.disable_sound[j]) {
+            accumulator += APU.channel[j].accumulator * APU.so_output[j][i];
+          }
         }
+        accumulator *= (APU.so_volume[i] + 1) * 16; /* 4bit -> 8bit samples. */
+        accumulator /= ((SOUND_OUTPUT_MAX_VOLUME + 1) * APU_CHANNEL_COUNT);
+        *buffer->position++ = accumulator / buffer->divisor;
       }
-      accumulator *= (APU.so_volume[i] + 1) * 16; /* 4bit -> 8bit samples. */
-      accumulator /= ((SOUND_OUTPUT_MAX_VOLUME + 1) * APU_CHANNEL_COUNT);
-      *buffer->position++ = accumulator / buffer->divisor;
     }
     for (j = 0; j < APU_CHANNEL_COUNT; ++j) {
+      if (buffer->channel_data) {
+        *buffer->channel_position++ =
+            APU.channel[j].accumulator * 16 / buffer->divisor;
+      }
       APU.channel[j].accumulator = 0;
     }
     buffer->divisor = 0;
   }
   assert(buffer->position <= buffer->end);
+  assert(buffer->channel_position <= buffer->channel_end);
 }
 
 static void apu_update_channels(Emulator* e, u32 total_frames) {
+  if (e->config.disable_audio) {
+    /* Only the wave channel's position is visible to the CPU (via wave RAM
+     * accesses while it is playing), so the other channels can be skipped. */
+    update_wave(e, APU.sync_ticks, total_frames);
+    APU.sync_ticks += total_frames * APU_TICKS;
+    return;
+  }
+  if (e->blep.deltas && !e->audio_buffer.channel_data) {
+    /* Steps are added at their exact tick, so there's no need to stop at each
+     * output frame. */
+    update_square_wave(e, &CHANNEL1, APU.sync_ticks, total_frames);
+    update_square_wave(e, &CHANNEL2, APU.sync_ticks, total_frames);
+    update_wave(e, APU.sync_ticks, total_frames);
+    update_noise(e, APU.sync_ticks, total_frames);
+    APU.sync_ticks += total_frames * APU_TICKS;
+    return;
+  }
   while (total_frames) {
     u32 frames = get_gb_frames_until_next_resampled_frame(e);
     frames = MIN(frames, total_frames);
-    update_square_wave(&CHANNEL1, frames);
-    update_square_wave(&CHANNEL2, frames);
+    update_square_wave(e, &CHANNEL1, APU.sync_ticks, frames);
+    update_square_wave(e, &CHANNEL2, APU.sync_ticks, frames);
     update_wave(e, APU.sync_ticks, frames);
-    update_noise(e, frames);
+    update_noise(e, APU.sync_ticks, frames);
     write_audio_frame(e, frames);
     APU.sync_ticks += frames * APU_TICKS;
     total_frames -= frames;
@@ -3897,6 +4403,7 @@ static void apu_update(Emulator* e, u32 total_ticks) {
         case 0: case 4: update_lengths(e); break;
         case 7: update_envelopes(e); break;
       }
+      apu_blep_update(e);
     }
     Ticks ticks = MIN(next_seq_ticks, total_ticks);
     apu_update_channels(e, ticks / APU_TICKS);
@@ -3913,22 +4420,28 @@ static void intr_synchronize(Emulator* e) {
 
 static void apu_synchronize(Emulator* e) {
   if (TICKS > APU.sync_ticks) {
+    PROFILE_BEGIN(APU);
     u32 ticks = TICKS - APU.sync_ticks;
     if (APU.enabled) {
       apu_update(e, ticks);
       assert(APU.sync_ticks == TICKS);
-    } else {
+    } else if ((!e->blep.deltas || e->audio_buffer.channel_data) &&
+               !e->config.disable_audio) {
       for (; ticks; ticks -= APU_TICKS) {
         write_audio_frame(e, 1);
       }
       APU.sync_ticks = TICKS;
+    } else {
+      APU.sync_ticks = TICKS;
     }
+    PROFILE_END();
   }
 }
 
 static void dma_synchronize(Emulator* e) {
   if (UNLIKELY(DMA.state != DMA_INACTIVE)) {
     if (TICKS > DMA.sync_ticks) {
+      PROFILE_BEGIN(DMA);
       Ticks delta_ticks = TICKS - DMA.sync_ticks;
       DMA.sync_ticks = TICKS;
 
@@ -3954,6 +4467,7 @@ static void dma_synchronize(Emulator* e) {
           break;
         }
       }
+      PROFILE_END();
     }
   }
 }
@@ -4000,6 +4514,7 @@ static void calculate_next_serial_intr(Emulator* e) {
 
 static void serial_synchronize(Emulator* e) {
   if (TICKS > SERIAL.sync_ticks) {
+    PROFILE_BEGIN(SERIAL);
     Ticks delta_ticks = TICKS - SERIAL.sync_ticks;
 
     if (UNLIKELY(SERIAL.transferring &&
@@ -4025,6 +4540,7 @@ static void serial_synchronize(Emulator* e) {
       }
     }
     SERIAL.sync_ticks = TICKS;
+    PROFILE_END();
   }
 }
 
@@ -4044,6 +4560,44 @@ static u16 read_u16_tick(Emulator* e, Address addr) {
   return (hi << 8) | lo;
 }
 
+/* Fetches the opcode at REG.PC. ROM never changes, and banks only switch on
+ * writes, which happen after all of an instruction's operand fetches. So when
+ * the whole instruction lies in one ROM bank, this returns a pointer to its
+ * operand bytes, letting them skip the memory map; otherwise returns NULL. */
+static const u8* read_opcode_tick(Emulator* e, u8* out_opcode) {
+  Address pc = REG.PC;
+  if (LIKELY(pc < 0x8000 && (pc & ADDR_MASK_16K) < ADDR_MASK_16K - 1)) {
+    u32 rom_addr =
+        MMAP_STATE.rom_base[pc >> ROM_BANK_SHIFT] | (pc & ADDR_MASK_16K);
+    const u8* code = &e->cart_info->data[rom_addr];
+    tick(e);
+    HOOK(read_rom_ib, rom_addr, code[0]);
+    *out_opcode = code[0];
+    return code + 1;
+  }
+  *out_opcode = read_u8_tick(e, pc);
+  return NULL;
+}
+
+/* Reads an operand at REG.PC, using |code| from read_opcode_tick if given. */
+static u8 read_operand_u8_tick(Emulator* e, const u8* code) {
+  if (LIKELY(code)) {
+    tick(e);
+    HOOK(read_rom_ib, (u32)(code - e->cart_info->data), code[0]);
+    return code[0];
+  }
+  return read_u8_tick(e, REG.PC);
+}
+
+static u16 read_operand_u16_tick(Emulator* e, const u8* code) {
+  if (LIKELY(code)) {
+    u8 lo = read_operand_u8_tick(e, code);
+    u8 hi = read_operand_u8_tick(e, code + 1);
+    return (hi << 8) | lo;
+  }
+  return read_u16_tick(e, REG.PC);
+}
+
 static void write_u8_tick(Emulator* e, Address addr, u8 value) {
   tick(e);
   write_u8(e, addr, value);
@@ -4082,8 +4636,8 @@ static void set_af_reg(Emulator* e, u16 af) {
 #define READ16(X) read_u16_tick(e, X)
 #define WRITE8(X, V) write_u8_tick(e, X, V)
 #define WRITE16(X, V) write_u16_tick(e, X, V)
-#define READ_N (new_pc += 1, READ8(REG.PC))
-#define READ_NN (new_pc += 2, READ16(REG.PC))
+#define READ_N (new_pc += 1, read_operand_u8_tick(e, code))
+#define READ_NN (new_pc += 2, read_operand_u16_tick(e, code))
 #define READMR(MR) READ8(REG.MR)
 #define WRITEMR(MR, V) WRITE8(REG.MR, V)
 #define BASIC_OP_R(R, OP) u = REG.R; OP; REG.R = u
@@ -4162,7 +4716,12 @@ static void set_af_reg(Emulator* e, u16 af) {
 #define JP_F_NN(COND) u16 = READ_NN; if (COND) { new_pc = u16; TICK; }
 #define JP_RR(RR) new_pc = REG.RR
 #define JP_NN new_pc = READ_NN; TICK
-#define JR new_pc += s; TICK
+#define JR                                             \
+  new_pc += s;                                         \
+  TICK;                                                \
+  if (s >= -IDLE_LOOP_MAX_LENGTH && s < 0) {           \
+    e->idle_loop_candidate = TRUE;                     \
+  }
 #define JR_F_N(COND) s = READ_N; if (COND) { JR; }
 #define JR_N s = READ_N; JR
 #define LD_R_R(RD, RS) REG.RD = REG.RS
@@ -4314,6 +4873,7 @@ static void execute_instruction(Emulator* e) {
   u8 u, c;
   u16 u16;
   Address new_pc;
+  const u8* code = NULL;
 
   if (UNLIKELY(TICKS >= e->state.next_intr_ticks)) {
     if (TICKS >= TIMER.next_intr_ticks) {
@@ -4331,7 +4891,7 @@ static void execute_instruction(Emulator* e) {
 
   if (LIKELY(INTR.state == CPU_STATE_NORMAL)) {
     should_dispatch = INTR.ime && (INTR.new_if & INTR.ie) != 0;
-    opcode = read_u8_tick(e, REG.PC);
+    code = read_opcode_tick(e, &opcode);
   } else {
     switch (INTR.state) {
       case CPU_STATE_NORMAL:
@@ -4529,7 +5089,7 @@ static void execute_instruction(Emulator* e) {
     case 0xca: JP_F_NN(FZ); break;
     case 0xcb: {
       new_pc += 1;
-      u8 cb = read_u8_tick(e, REG.PC);
+      u8 cb = read_operand_u8_tick(e, code);
       HOOK(exec_cb_op_i, cb);
       switch (cb) {
         REG_OPS(0x00, RLC)
@@ -4623,26 +5183,190 @@ static void emulator_step_internal(Emulator* e) {
     execute_instruction(e);
   } else {
     tick(e);
+    PROFILE_BEGIN(DMA);
     hdma_copy_byte(e);
     hdma_copy_byte(e);
+    PROFILE_END();
   }
 }
 
+static Bool is_idle_loop_code_addr(Address addr) {
+  return addr < 0x8000 || (addr >= 0xc000 && addr < 0xe000) ||
+         (addr >= 0xff80 && addr < 0xffff);
+}
+
+/* Returns TRUE if the value read from addr can only change at the next
+ * timer, serial or PPU event (or by an interrupt handler). */
+static Bool is_idle_loop_poll_addr(Emulator* e, Address addr) {
+  switch (addr) {
+    case 0xff00 + IO_LY_ADDR:
+      return TRUE;
+    case 0xff00 + IO_STAT_ADDR:
+      /* The LY=LYC bit lags one tick behind the rest of the PPU state. */
+      ppu_synchronize(e);
+      return STAT.ly_eq_lyc == STAT.new_ly_eq_lyc;
+    default:
+      return (addr >= 0xc000 && addr < 0xe000) ||
+             (addr >= 0xff80 && addr < 0xffff);
+  }
+}
+
+/* A CPU that is halted, or spinning in a short loop polling LY, STAT or RAM,
+ * can't do anything observable until the next timer, serial or PPU event.
+ * Instead of stepping one instruction at a time, skip straight to that event
+ * (or until_ticks), and let the other subsystems catch up when they are next
+ * synchronized. The recognized loops are:
+ *
+ *   jr @
+ *   ld a, [nn] / ldh a, [n]
+ *   cp n / and n / and a / or a / bit b, a
+ *   jr cc, <loop start>
+ *
+ * Only whole iterations are skipped, none past until_ticks and none whose
+ * final jr starts after the next event, so the emulated state is identical
+ * to stepping. */
+static void idle_fast_forward(Emulator* e, Ticks until_ticks) {
+  e->idle_loop_candidate = FALSE;
+  if (e->state.event != 0 || HDMA.state != DMA_INACTIVE ||
+      TICKS >= e->state.next_intr_ticks || HOOK0_FALSE(idle_fast_forward)) {
+    return;
+  }
+
+  const Ticks cpu_tick = e->state.cpu_tick;
+  const Ticks end_ticks = MIN(e->state.next_intr_ticks, until_ticks);
+  if (TICKS >= end_ticks) {
+    return;
+  }
+  if (INTR.state == CPU_STATE_HALT) {
+    if ((INTR.new_if & INTR.ie) == 0) {
+      TICKS += DIV_CEIL(end_ticks - TICKS, cpu_tick) * cpu_tick;
+      INTR.if_ = INTR.new_if;
+    }
+    return;
+  }
+
+  const Address pc = REG.PC;
+  if (INTR.state != CPU_STATE_NORMAL ||
+      (INTR.ime && (INTR.new_if & INTR.ie) != 0) ||
+      !is_idle_loop_code_addr(pc) ||
+      !is_idle_loop_code_addr(pc + IDLE_LOOP_MAX_LENGTH - 1)) {
+    return;
+  }
+
+  u8 code[IDLE_LOOP_MAX_LENGTH];
+  int i;
+  for (i = 0; i < IDLE_LOOP_MAX_LENGTH; ++i) {
+    code[i] = read_u8_raw(e, pc + i);
+  }
+
+  /* M-cycles from the start of an iteration to the start of its final jr. */
+  int jr_cycles = 0;
+  int length = 0;
+  Registers old_reg = REG;
+  if (code[0] == 0x18 && code[1] == 0xfe) { /* jr @ */
+    length = 2;
+  } else {
+    Address addr;
+    if (code[0] == 0xf0) { /* ldh a, [n] */
+      addr = 0xff00 | code[1];
+      length = 2;
+      jr_cycles = 3;
+    } else if (code[0] == 0xfa) { /* ld a, [nn] */
+      addr = (code[2] << 8) | code[1];
+      length = 3;
+      jr_cycles = 4;
+    } else {
+      return;
+    }
+    if (!is_idle_loop_poll_addr(e, addr)) {
+      return;
+    }
+
+    /* Nothing that the loop reads changes before end_ticks, so evaluate one
+     * iteration here; every skipped iteration ends the same way. */
+    u8 u = code[length + 1];
+    RA = read_u8_raw(e, addr);
+    switch (code[length]) {
+      case 0xfe: CP_FLAGS(RA, u); length += 2; jr_cycles += 2; break;
+      case 0xe6: RA &= u; AND_FLAGS; length += 2; jr_cycles += 2; break;
+      case 0xa7: AND_FLAGS; length += 1; jr_cycles += 1; break;
+      case 0xb7: OR_FLAGS; length += 1; jr_cycles += 1; break;
+      case 0xcb:
+        if ((u & 0xc7) == 0x47) { /* bit b, a */
+          BIT_FLAGS((u >> 3) & 7, RA);
+          length += 2;
+          jr_cycles += 2;
+          break;
+        }
+        /* Fallthrough. */
+      default:
+        REG = old_reg;
+        return;
+    }
+
+    Bool taken;
+    switch (code[length]) {
+      case 0x20: taken = !FZ; break;
+      case 0x28: taken = FZ; break;
+      case 0x30: taken = !FC; break;
+      case 0x38: taken = FC; break;
+      default: taken = FALSE; break;
+    }
+    length += 2;
+    if (!taken || (s8)code[length - 1] != -length) {
+      REG = old_reg;
+      return;
+    }
+  }
+
+  /* The jr at the end of the last skipped iteration must start before
+   * next_intr_ticks; everything else in the iteration happens before it.
+   * Stepping would stop at the first instruction that ends at or after
+   * until_ticks, which may be inside an iteration, so only skip the
+   * iterations that end by then and let the caller step the rest. */
+  Ticks jr_ticks = jr_cycles * cpu_tick;
+  Ticks loop_ticks = jr_ticks + 3 * cpu_tick;
+  Ticks iterations =
+      end_ticks > TICKS + jr_ticks
+          ? DIV_CEIL(end_ticks - TICKS - jr_ticks, loop_ticks)
+          : 0;
+  iterations = MIN(iterations, (until_ticks - TICKS) / loop_ticks);
+  if (iterations == 0) {
+    REG = old_reg;
+    return;
+  }
+  TICKS += iterations * loop_ticks;
+  INTR.if_ = INTR.new_if;
+}
+
 EmulatorEvent emulator_run_until(Emulator* e, Ticks until_ticks) {
+  /* Timing each instruction would cost more than executing it, so the CPU
+   * is charged for everything that isn't in another subsystem. */
+  PROFILE_BEGIN(CPU);
   AudioBuffer* ab = &e->audio_buffer;
   if (e->state.event & EMULATOR_EVENT_AUDIO_BUFFER_FULL) {
     ab->position = ab->data;
+    ab->channel_position = ab->channel_data;
   }
   check_joyp_intr(e);
   e->state.event = 0;
+  apu_blep_update(e); /* In case the config changed. */
 
-  u64 frames_left = ab->frames - audio_buffer_get_frames(ab);
-  Ticks max_audio_ticks =
-      APU.sync_ticks +
-      (u32)DIV_CEIL(frames_left * CPU_TICKS_PER_SECOND, ab->frequency);
+  Ticks max_audio_ticks = INVALID_TICKS;
+  if (!e->config.disable_audio) {
+    u64 frames_left = ab->frames - audio_buffer_get_frames(ab);
+    max_audio_ticks =
+        APU.sync_ticks +
+        (u32)DIV_CEIL(frames_left * CPU_TICKS_PER_SECOND, ab->frequency);
+  }
   Ticks check_ticks = MIN(until_ticks, max_audio_ticks);
   while (e->state.event == 0 && TICKS < check_ticks) {
     emulator_step_internal(e);
+    if (UNLIKELY(INTR.state == CPU_STATE_HALT || e->idle_loop_candidate)) {
+      PROFILE_BEGIN(IDLE);
+      idle_fast_forward(e, check_ticks);
+      PROFILE_END();
+    }
   }
   if (TICKS >= max_audio_ticks) {
     e->state.event |= EMULATOR_EVENT_AUDIO_BUFFER_FULL;
@@ -4651,6 +5375,12 @@ EmulatorEvent emulator_run_until(Emulator* e, Ticks until_ticks) {
     e->state.event |= EMULATOR_EVENT_UNTIL_TICKS;
   }
   apu_synchronize(e);
+  if (blep_active(e)) {
+    PROFILE_BEGIN(APU);
+    apu_blep_render(e);
+    PROFILE_END();
+  }
+  PROFILE_END();
   return e->state.event;
 }
 
@@ -4696,16 +5426,55 @@ static void log_cart_info(CartInfo* cart_info) {
          get_result_string(validate_header_checksum(cart_info)));
 }
 
-Result init_audio_buffer(Emulator* e, u32 frequency, u32 frames) {
+/* The DC blocker's decay per output frame, so its cutoff doesn't depend on
+ * the output rate. */
+static void blep_set_highpass_charge(Blep* blep, u32 frequency) {
+  f64 charge = 1;
+  u32 i;
+  for (i = 0; i < CPU_TICKS_PER_SECOND / frequency; ++i) {
+    charge *= BLEP_HIGHPASS_CHARGE_PER_TICK;
+  }
+  blep->highpass_charge = (f32)charge;
+}
+
+Result init_audio_buffer(Emulator* e, u32 frequency, u32 frames,
+                         AudioFormat format, Bool capture_channels) {
+  static const u32 s_sample_size[] = {[AUDIO_FORMAT_U8] = sizeof(u8),
+                                      [AUDIO_FORMAT_S16] = sizeof(s16),
+                                      [AUDIO_FORMAT_F32] = sizeof(f32)};
+  CHECK_MSG(format < AUDIO_FORMAT_COUNT, "Unknown audio format: %d\n", format);
   AudioBuffer* audio_buffer = &e->audio_buffer;
   audio_buffer->frames = frames;
+  audio_buffer->format = format;
+  audio_buffer->frame_size = s_sample_size[format] * SOUND_OUTPUT_COUNT;
   size_t buffer_size =
-      (frames + AUDIO_BUFFER_EXTRA_FRAMES) * SOUND_OUTPUT_COUNT;
+      (frames + AUDIO_BUFFER_EXTRA_FRAMES) * audio_buffer->frame_size;
   audio_buffer->data = xmalloc(buffer_size);
   CHECK_MSG(audio_buffer->data != NULL, "Audio buffer allocation failed.\n");
   audio_buffer->end = audio_buffer->data + buffer_size;
   audio_buffer->position = audio_buffer->data;
   audio_buffer->frequency = frequency;
+
+  if (capture_channels) {
+    size_t channel_size =
+        (frames + AUDIO_BUFFER_EXTRA_FRAMES) * APU_CHANNEL_COUNT;
+    audio_buffer->channel_data = xmalloc(channel_size);
+    CHECK_MSG(audio_buffer->channel_data != NULL,
+              "Audio buffer allocation failed.\n");
+    audio_buffer->channel_end = audio_buffer->channel_data + channel_size;
+    audio_buffer->channel_position = audio_buffer->channel_data;
+  }
+
+  if (format != AUDIO_FORMAT_U8) {
+    Blep* blep = &e->blep;
+    blep->deltas =
+        xcalloc((frames + AUDIO_BUFFER_EXTRA_FRAMES + BLEP_WIDTH) *
+                    SOUND_OUTPUT_COUNT,
+                sizeof(s32));
+    CHECK_MSG(blep->deltas != NULL, "Audio buffer allocation failed.\n");
+    blep_set_highpass_charge(blep, frequency);
+    blep->volume = 1;
+  }
   return OK;
   ON_ERROR_RETURN;
 }
@@ -4720,6 +5489,39 @@ static u32 random_u32(u32* state) {
   return x;
 }
 
+/* Pages that lie entirely within VRAM, WRAM or external RAM are tracked by
+ * mark_state_dirty; all others are copied by every snapshot. */
+static void init_state_pages(Emulator* e) {
+  static const struct {
+    size_t begin, end;
+  } s_tracked[] = {
+      {offsetof(EmulatorState, vram.data),
+       offsetof(EmulatorState, vram.data) + VIDEO_RAM_SIZE},
+      {offsetof(EmulatorState, ext_ram.data),
+       offsetof(EmulatorState, ext_ram.data) + EXT_RAM_MAX_SIZE},
+      {offsetof(EmulatorState, wram.data),
+       offsetof(EmulatorState, wram.data) + WORK_RAM_SIZE},
+  };
+  assert(STATE_PAGE_COUNT <= EMULATOR_STATE_MAX_PAGES);
+  ZERO_MEMORY(e->untracked_state_pages);
+  size_t page;
+  for (page = 0; page < STATE_PAGE_COUNT; ++page) {
+    size_t begin = page * EMULATOR_STATE_PAGE_SIZE;
+    size_t end = MIN(begin + EMULATOR_STATE_PAGE_SIZE, sizeof(EmulatorState));
+    Bool tracked = FALSE;
+    size_t i;
+    for (i = 0; i < ARRAY_SIZE(s_tracked); ++i) {
+      if (begin >= s_tracked[i].begin && end <= s_tracked[i].end) {
+        tracked = TRUE;
+      }
+    }
+    if (!tracked) {
+      e->untracked_state_pages.bits[page >> 5] |= 1u << (page & 31);
+    }
+  }
+  mark_all_state_dirty(e);
+}
+
 static void randomize_buffer(u32* seed, u8* buffer, u32 size) {
   while (size >= sizeof(u32)) {
     u32 x = random_u32(seed);
@@ -4742,7 +5544,7 @@ Result init_emulator(Emulator* e, const EmulatorInit* init) {
       0x60, 0x0d, 0xda, 0xdd, 0x50, 0x0f, 0xad, 0xed,
       0xc0, 0xde, 0xf0, 0x0d, 0xbe, 0xef, 0xfe, 0xed,
   };
-  CHECK(SUCCESS(get_cart_infos(e)));
+  set_cart_info(e, e->rom->initial_cart_info_index);
   log_cart_info(e->cart_info);
   MMAP_STATE.rom_base[0] = 0;
   MMAP_STATE.rom_base[1] = 1 << ROM_BANK_SHIFT;
@@ -4813,8 +5615,8 @@ Result init_emulator(Emulator* e, const EmulatorInit* init) {
 
   e->state.cpu_tick = CPU_TICK;
   calculate_next_ppu_intr(e);
+  init_state_pages(e);
   return OK;
-  ON_ERROR_RETURN;
 }
 
 void emulator_set_joypad_buttons(Emulator* e, JoypadButtons* buttons) {
@@ -4832,6 +5634,17 @@ JoypadCallbackInfo emulator_get_joypad_callback(Emulator* e) {
 }
 
 void emulator_set_config(Emulator* e, const EmulatorConfig* config) {
+  if (e->config.disable_audio && !config->disable_audio) {
+    /* No frames were rendered while audio was disabled; start again from the
+     * current time. Only the wave channel kept running, but none of the
+     * accumulated samples belong to the next frame. */
+    e->blep.base = (u64)APU.sync_ticks * e->audio_buffer.frequency;
+    int i;
+    for (i = 0; i < APU_CHANNEL_COUNT; ++i) {
+      APU.channel[i].accumulator = 0;
+    }
+    e->audio_buffer.divisor = 0;
+  }
   e->config = *config;
 }
 
@@ -4860,7 +5673,29 @@ u32 emulator_get_ppu_frame(Emulator* e) {
 }
 
 u32 audio_buffer_get_frames(AudioBuffer* audio_buffer) {
-  return (audio_buffer->position - audio_buffer->data) / SOUND_OUTPUT_COUNT;
+  return (audio_buffer->position - audio_buffer->data) /
+         audio_buffer->frame_size;
+}
+
+u32 audio_buffer_get_channel_frames(AudioBuffer* audio_buffer) {
+  return (audio_buffer->channel_position - audio_buffer->channel_data) /
+         APU_CHANNEL_COUNT;
+}
+
+void emulator_set_audio_volume(Emulator* e, f32 volume) {
+  e->blep.volume = CLAMP(volume, 0, 1);
+}
+
+void emulator_set_audio_frequency(Emulator* e, u32 frequency) {
+  AudioBuffer* buffer = &e->audio_buffer;
+  if (e->blep.deltas) {
+    /* |base| is scaled by the frequency; keep it at the same time. */
+    u64 pending = (u64)APU.sync_ticks * buffer->frequency - e->blep.base;
+    e->blep.base = (u64)APU.sync_ticks * frequency -
+                   pending * frequency / buffer->frequency;
+    blep_set_highpass_charge(&e->blep, frequency);
+  }
+  buffer->frequency = frequency;
 }
 
 void emulator_set_bw_palette(Emulator* e, PaletteType type,
@@ -4875,14 +5710,39 @@ void emulator_set_all_bw_palettes(Emulator* e, const PaletteRGBA* palette) {
   e->color_to_rgba[PALETTE_TYPE_OBP1] = *palette;
 }
 
-static Result set_rom_file_data(Emulator* e, const FileData* file_data) {
+EmulatorRom* emulator_rom_new(const FileData* file_data,
+                              FileDataFreeFunc free_file_data) {
+  EmulatorRom* rom = xcalloc(1, sizeof(EmulatorRom));
   CHECK_MSG(file_data->size > 0, "File is empty.\n");
   CHECK_MSG((file_data->size & (MINIMUM_ROM_SIZE - 1)) == 0,
             "File size (%ld) should be a multiple of minimum rom size (%ld).\n",
             (long)file_data->size, (long)MINIMUM_ROM_SIZE);
-  e->file_data = *file_data;
-  return OK;
-  ON_ERROR_RETURN;
+  rom->file_data = *file_data;
+  CHECK(SUCCESS(get_cart_infos(rom)));
+  rom->free_file_data = free_file_data;
+  rom->ref_count = 1;
+  return rom;
+error:
+  xfree(rom);
+  return NULL;
+}
+
+static EmulatorRom* emulator_rom_retain(EmulatorRom* rom) {
+  assert(rom->ref_count > 0);
+  rom->ref_count++;
+  return rom;
+}
+
+void emulator_rom_release(EmulatorRom* rom) {
+  if (rom) {
+    assert(rom->ref_count > 0);
+    if (--rom->ref_count == 0) {
+      if (rom->free_file_data) {
+        rom->free_file_data(&rom->file_data);
+      }
+      xfree(rom);
+    }
+  }
 }
 
 Bool emulator_was_ext_ram_updated(Emulator* e) {
@@ -4910,6 +5770,8 @@ Result emulator_read_state(Emulator* e, const FileData* file_data) {
             "header mismatch: %u, expected %u.\n", new_state->header,
             SAVE_STATE_HEADER);
   memcpy(&e->state, new_state, sizeof(EmulatorState));
+  mark_all_state_dirty(e);
+  HOOK0(read_state);
   set_cart_info(e, e->state.cart_info_index);
 
   if (IS_SGB) {
@@ -4919,6 +5781,9 @@ Result emulator_read_state(Emulator* e, const FileData* file_data) {
   update_bw_palette_rgba(e, PALETTE_TYPE_BGP);
   update_bw_palette_rgba(e, PALETTE_TYPE_OBP0);
   update_bw_palette_rgba(e, PALETTE_TYPE_OBP1);
+  /* The APU's clock may have moved backward; restart the output from here. */
+  e->blep.base = (u64)APU.sync_ticks * e->audio_buffer.frequency;
+  e->apu_log.drained_ticks = TICKS;
   return OK;
   ON_ERROR_RETURN;
 }
@@ -4931,6 +5796,41 @@ Result emulator_write_state(Emulator* e, FileData* file_data) {
   ON_ERROR_RETURN;
 }
 
+Result emulator_write_state_snapshot(Emulator* e, FileData* file_data,
+                                     EmulatorStatePages* out_written) {
+  CHECK(file_data->size >= sizeof(EmulatorState));
+  e->state.header = SAVE_STATE_HEADER;
+  EmulatorStatePages written;
+  size_t i;
+  for (i = 0; i < ARRAY_SIZE(written.bits); ++i) {
+    written.bits[i] =
+        e->dirty_state_pages.bits[i] | e->untracked_state_pages.bits[i];
+  }
+
+  /* Copy each run of written pages with a single memcpy. */
+  const u8* state = (const u8*)&e->state;
+  size_t page = 0;
+  while (page < STATE_PAGE_COUNT) {
+    if (!EMULATOR_STATE_PAGES_HAS(written, page)) {
+      page++;
+      continue;
+    }
+    size_t begin = page * EMULATOR_STATE_PAGE_SIZE;
+    while (page < STATE_PAGE_COUNT && EMULATOR_STATE_PAGES_HAS(written, page)) {
+      page++;
+    }
+    size_t end = MIN(page * EMULATOR_STATE_PAGE_SIZE, sizeof(EmulatorState));
+    memcpy(file_data->data + begin, state + begin, end - begin);
+  }
+
+  ZERO_MEMORY(e->dirty_state_pages);
+  if (out_written) {
+    *out_written = written;
+  }
+  return OK;
+  ON_ERROR_RETURN;
+}
+
 Result emulator_read_ext_ram(Emulator* e, const FileData* file_data) {
   if (EXT_RAM.battery_type != BATTERY_TYPE_WITH_BATTERY)
     return OK;
@@ -4939,6 +5839,7 @@ Result emulator_read_ext_ram(Emulator* e, const FileData* file_data) {
             "save file is wrong size: %ld, expected %ld.\n",
             (long)file_data->size, (long)EXT_RAM.size);
   memcpy(EXT_RAM.data, file_data->data, file_data->size);
+  mark_all_state_dirty(e);
   return OK;
   ON_ERROR_RETURN;
 }
@@ -5009,10 +5910,18 @@ error:
 
 Emulator* emulator_new(const EmulatorInit* init) {
   Emulator* e = xcalloc(1, sizeof(Emulator));
-  CHECK(SUCCESS(set_rom_file_data(e, &init->rom)));
+  HOOK(emulator_new_p, init->debug);
+  if (init->shared_rom) {
+    e->rom = emulator_rom_retain(init->shared_rom);
+  } else {
+    /* |init->rom| still belongs to the caller. */
+    e->rom = emulator_rom_new(&init->rom, NULL);
+    CHECK(e->rom != NULL);
+  }
   CHECK(SUCCESS(init_emulator(e, init)));
   CHECK(
-      SUCCESS(init_audio_buffer(e, init->audio_frequency, init->audio_frames)));
+      SUCCESS(init_audio_buffer(e, init->audio_frequency, init->audio_frames,
+                                init->audio_format, init->capture_channels)));
   return e;
 error:
   emulator_delete(e);
@@ -5021,7 +5930,13 @@ error:
 
 void emulator_delete(Emulator* e) {
   if (e) {
+    HOOK0(emulator_delete);
     xfree(e->audio_buffer.data);
+    xfree(e->audio_buffer.channel_data);
+    xfree(e->blep.deltas);
+    emulator_reset_apu_log(e);
+    xfree(e->apu_log.spare);
+    emulator_rom_release(e->rom);
     xfree(e);
   }
 }
@@ -5057,10 +5972,131 @@ void emulator_set_builtin_palette(Emulator* e, u32 index) {
   update_bw_palette_rgba(e, PALETTE_TYPE_BGP);
 }
 
-ApuLog* emulator_get_apu_log(Emulator* e) {
-  return &e->apu_log;
+size_t emulator_get_apu_log_count(Emulator* e) {
+  return e->apu_log.count;
+}
+
+/* The oldest writes that are contiguous in memory; at most |max_count|. */
+static size_t apu_log_peek(ApuLog* log, size_t max_count, ApuWrite** out) {
+  if (!log->head) {
+    return 0;
+  }
+  *out = log->head->writes + log->head->begin;
+  return MIN(max_count, log->head->end - log->head->begin);
+}
+
+static void apu_log_consume(ApuLog* log, size_t count) {
+  ApuLogChunk* chunk = log->head;
+  log->drained_ticks = chunk->writes[chunk->begin + count - 1].ticks;
+  chunk->begin += count;
+  log->count -= count;
+  if (chunk->begin == chunk->end) {
+    log->head = chunk->next;
+    if (!log->head) {
+      log->tail = NULL;
+    }
+    xfree(log->spare);
+    log->spare = chunk;
+  }
+}
+
+size_t emulator_drain_apu_log(Emulator* e, ApuWrite* writes,
+                              size_t max_count) {
+  ApuLog* log = &e->apu_log;
+  size_t total = 0;
+  ApuWrite* src;
+  size_t count;
+  while ((count = apu_log_peek(log, max_count - total, &src)) != 0) {
+    memcpy(writes + total, src, count * sizeof(ApuWrite));
+    apu_log_consume(log, count);
+    total += count;
+  }
+  return total;
 }
 
 void emulator_reset_apu_log(Emulator* e) {
-  e->apu_log.write_count = 0;
+  ApuLog* log = &e->apu_log;
+  ApuWrite* src;
+  size_t count;
+  while ((count = apu_log_peek(log, log->count, &src)) != 0) {
+    apu_log_consume(log, count);
+  }
+}
+
+/* LEB128 tick delta (at most 10 bytes for a u64), then addr and value. */
+#define APU_LOG_MAX_RECORD_SIZE 12
+
+static u8* encode_apu_log(Emulator* e, u8* p) {
+  ApuLog* log = &e->apu_log;
+  ApuWrite* src;
+  size_t count;
+  while ((count = apu_log_peek(log, log->count, &src)) != 0) {
+    Ticks last_ticks = log->drained_ticks;
+    size_t i;
+    for (i = 0; i < count; ++i) {
+      /* Writes logged before a state load may be later than those after. */
+      Ticks delta =
+          src[i].ticks > last_ticks ? src[i].ticks - last_ticks : 0;
+      for (; delta >= 0x80; delta >>= 7) {
+        *p++ = (u8)(delta | 0x80);
+      }
+      *p++ = (u8)delta;
+      *p++ = src[i].addr;
+      *p++ = src[i].value;
+      last_ticks = src[i].ticks;
+    }
+    apu_log_consume(log, count);
+  }
+  return p;
+}
+
+Result emulator_write_apu_log_to_file(Emulator* e, const char* filename) {
+  Result result = ERROR;
+  FileData file_data;
+  file_data.size = sizeof(u32) + e->apu_log.count * APU_LOG_MAX_RECORD_SIZE;
+  file_data.data = xmalloc(file_data.size);
+  u8* p = file_data.data;
+  *p++ = (u8)APU_LOG_FILE_HEADER;
+  *p++ = (u8)(APU_LOG_FILE_HEADER >> 8);
+  *p++ = (u8)(APU_LOG_FILE_HEADER >> 16);
+  *p++ = (u8)(APU_LOG_FILE_HEADER >> 24);
+  file_data.size = encode_apu_log(e, p) - file_data.data;
+  CHECK(SUCCESS(file_write(filename, &file_data)));
+  result = OK;
+error:
+  file_data_delete(&file_data);
+  return result;
+}
+
+EmulatorProfile emulator_get_profile(Emulator* e) {
+#ifdef BINJGB_PROFILE
+  EmulatorProfile profile = e->profile;
+  profile.enabled = TRUE;
+  profile.clock_unit = PROFILE_CLOCK_UNIT;
+  return profile;
+#else
+  EmulatorProfile profile;
+  ZERO_MEMORY(profile);
+  return profile;
+#endif
+}
+
+void emulator_reset_profile(Emulator* e) {
+#ifdef BINJGB_PROFILE
+  ZERO_MEMORY(e->profile);
+#endif
+}
+
+const char* emulator_get_profile_kind_name(EmulatorProfileKind kind) {
+  static const char* s_strings[] = {
+      [EMULATOR_PROFILE_CPU] = "cpu",
+      [EMULATOR_PROFILE_IDLE] = "idle",
+      [EMULATOR_PROFILE_PPU] = "ppu",
+      [EMULATOR_PROFILE_PPU_MODE3] = "ppu_mode3",
+      [EMULATOR_PROFILE_APU] = "apu",
+      [EMULATOR_PROFILE_DMA] = "dma",
+      [EMULATOR_PROFILE_TIMER] = "timer",
+      [EMULATOR_PROFILE_SERIAL] = "serial",
+  };
+  return get_enum_string(s_strings, ARRAY_SIZE(s_strings), kind);
 }
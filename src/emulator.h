@@ -46,9 +46,19 @@ extern "C" {
 #define RGBA_DARK_GRAY 0xff555555u
 #define RGBA_BLACK 0xff000000u
 
-#define MAX_APU_LOG_FRAME_WRITES 1024
+#define APU_LOG_CHUNK_WRITES 1024
+#define APU_LOG_FILE_VERSION (1)
+#define APU_LOG_FILE_HEADER (u32)(0x3a4b1c00 + APU_LOG_FILE_VERSION)
+
+/* Granularity of save state dirty tracking; see
+ * emulator_write_state_snapshot. */
+#define EMULATOR_STATE_PAGE_SIZE 1024
+#define EMULATOR_STATE_MAX_PAGES 256
+#define EMULATOR_STATE_PAGES_HAS(pages, page) \
+  (((pages).bits[(page) >> 5] >> ((page) & 31)) & 1)
 
 typedef struct Emulator Emulator;
+typedef struct EmulatorRom EmulatorRom;
 
 enum {
   APU_CHANNEL1,
@@ -59,6 +69,7 @@ enum {
 };
 
 typedef void (*JoypadCallback)(struct JoypadButtons* joyp, void* user_data);
+typedef void (*FileDataFreeFunc)(FileData*);
 
 typedef struct JoypadCallbackInfo {
   JoypadCallback callback;
@@ -145,14 +156,29 @@ typedef struct PaletteRGBA {
   RGBA color[PALETTE_COLOR_COUNT];
 } PaletteRGBA;
 
+typedef enum AudioFormat {
+  AUDIO_FORMAT_U8,  /* Unsigned 8-bit, box-filtered per output frame. */
+  AUDIO_FORMAT_S16, /* Signed 16-bit, band-limited synthesis. */
+  AUDIO_FORMAT_F32, /* 32-bit float in [-1, 1], band-limited synthesis. */
+  AUDIO_FORMAT_COUNT,
+} AudioFormat;
+
 typedef struct AudioBuffer {
   u32 frequency;    /* Sample frequency, as N samples per second */
   u32 freq_counter; /* Used for resampling; [0..APU_TICKS_PER_SECOND). */
   u32 divisor;
   u32 frames; /* Number of frames to generate per call to emulator_run. */
-  u8* data;   /* Unsigned 8-bit 2-channel samples @ |frequency| */
+  AudioFormat format;
+  u32 frame_size; /* Size of one 2-channel frame, in bytes. */
+  u8* data;   /* 2-channel samples in |format| @ |frequency| */
   u8* end;
   u8* position;
+  /* If EmulatorInit.capture_channels is set, the unmixed output of each
+   * channel as APU_CHANNEL_COUNT u8 samples per frame @ |frequency|, before
+   * panning and master volume. Otherwise NULL. */
+  u8* channel_data;
+  u8* channel_end;
+  u8* channel_position;
 } AudioBuffer;
 
 typedef enum CgbColorCurve {
@@ -163,12 +189,18 @@ typedef enum CgbColorCurve {
 
 typedef struct EmulatorInit {
   FileData rom;
+  /* If set, |rom| is ignored and the emulator shares this ROM instead. */
+  EmulatorRom* shared_rom;
   int audio_frequency;
   int audio_frames;
+  AudioFormat audio_format;
   u32 random_seed;
   u32 builtin_palette;
   Bool force_dmg;
   CgbColorCurve cgb_color_curve;
+  Bool capture_channels; /* Fill AudioBuffer.channel_data. */
+  /* Debug context to attach at creation; only used by emulator-debug.c. */
+  struct EmulatorDebug* debug;
 } EmulatorInit;
 
 typedef struct EmulatorConfig {
@@ -178,17 +210,49 @@ typedef struct EmulatorConfig {
   Bool disable_obj;
   Bool allow_simulataneous_dpad_opposites;
   Bool log_apu_writes;
+  /* Skip sample generation; the APU registers still behave as usual, but the
+   * audio buffer is never written and AUDIO_BUFFER_FULL is never returned. */
+  Bool disable_audio;
+  /* Don't write the frame buffer, e.g. for frames that won't be shown. PPU
+   * timing, STAT and LY are unaffected. Best changed between frames. */
+  Bool skip_render;
 } EmulatorConfig;
 
 typedef struct {
-  u8 addr;
+  Ticks ticks;
+  u8 addr; /* Offset from 0xff10, i.e. 0 is NR10. */
   u8 value;
+  u8 padding[6];
 } ApuWrite;
 
+typedef enum {
+  EMULATOR_PROFILE_CPU,  /* Includes the emulator_run_until loop itself. */
+  EMULATOR_PROFILE_IDLE, /* Skipping halts and idle loops. */
+  EMULATOR_PROFILE_PPU,
+  EMULATOR_PROFILE_PPU_MODE3,
+  EMULATOR_PROFILE_APU,
+  EMULATOR_PROFILE_DMA, /* OAM DMA and HDMA. */
+  EMULATOR_PROFILE_TIMER,
+  EMULATOR_PROFILE_SERIAL,
+  EMULATOR_PROFILE_COUNT,
+} EmulatorProfileKind;
+
+/* Host time spent in each subsystem, only collected if the emulator is built
+ * with BINJGB_PROFILE defined. Time spent in a nested subsystem (e.g. the PPU,
+ * synchronized by the CPU reading STAT) is only counted for the innermost
+ * one. |calls| only counts synchronize calls that had ticks to catch up on;
+ * for EMULATOR_PROFILE_CPU it counts emulator_run_until calls. */
+typedef struct {
+  Bool enabled;
+  const char* clock_unit; /* "cycles" (rdtsc) or "ns". */
+  u64 clocks[EMULATOR_PROFILE_COUNT];
+  u64 calls[EMULATOR_PROFILE_COUNT];
+} EmulatorProfile;
+
+/* Set of EMULATOR_STATE_PAGE_SIZE pages of the save state. */
 typedef struct {
-  ApuWrite writes[MAX_APU_LOG_FRAME_WRITES];
-  size_t write_count;
-} ApuLog;
+  u32 bits[EMULATOR_STATE_MAX_PAGES / 32];
+} EmulatorStatePages;
 
 typedef u32 EmulatorEvent;
 enum {
@@ -204,6 +268,18 @@ extern const size_t s_emulator_state_size;
 Emulator* emulator_new(const EmulatorInit*);
 void emulator_delete(Emulator*);
 
+/* A ROM with its cart headers already parsed, which many emulators can share
+ * through EmulatorInit.shared_rom. It is never modified. Each emulator holds
+ * a reference, so it can be released as soon as the emulators are created.
+ * On success the image takes ownership of |rom| without copying it, and
+ * passes it to |free_rom| (e.g. file_data_delete or file_data_unmap) when the
+ * last reference is released; with a NULL |free_rom| the data must outlive
+ * every emulator using it instead. On failure |rom| still belongs to the
+ * caller. References are not atomic; create and delete the emulators on one
+ * thread. */
+EmulatorRom* emulator_rom_new(const FileData* rom, FileDataFreeFunc free_rom);
+void emulator_rom_release(EmulatorRom*);
+
 void emulator_set_joypad_buttons(Emulator*, JoypadButtons*);
 void emulator_set_joypad_callback(Emulator*, JoypadCallback, void* user_data);
 JoypadCallbackInfo emulator_get_joypad_callback(Emulator*);
@@ -215,6 +291,12 @@ AudioBuffer* emulator_get_audio_buffer(Emulator*);
 Ticks emulator_get_ticks(Emulator*);
 u32 emulator_get_ppu_frame(Emulator*);
 u32 audio_buffer_get_frames(AudioBuffer*);
+u32 audio_buffer_get_channel_frames(AudioBuffer*);
+/* Scale for AUDIO_FORMAT_S16 and AUDIO_FORMAT_F32 output; [0..1]. */
+void emulator_set_audio_volume(Emulator*, f32 volume);
+/* Change the output sample rate without restarting the output, e.g. to
+ * follow the rate the host is actually consuming samples at. */
+void emulator_set_audio_frequency(Emulator*, u32 frequency);
 void emulator_set_builtin_palette(Emulator*, u32 index);
 void emulator_set_bw_palette(Emulator*, PaletteType, const PaletteRGBA*);
 void emulator_set_all_bw_palettes(Emulator*, const PaletteRGBA*);
@@ -228,6 +310,12 @@ void emulator_init_state_file_data(FileData*);
 void emulator_init_ext_ram_file_data(Emulator*, FileData*);
 Result emulator_read_state(Emulator*, const FileData*);
 Result emulator_write_state(Emulator*, FileData*);
+/* Like emulator_write_state, but only copies the pages that may have changed
+ * since the previous snapshot, so |file_data| must still hold that snapshot
+ * (or a state written afterward by emulator_write_state). The copied pages are
+ * returned in |out_written|, if non-NULL. */
+Result emulator_write_state_snapshot(Emulator*, FileData*,
+                                     EmulatorStatePages* out_written);
 Result emulator_read_ext_ram(Emulator*, const FileData*);
 Result emulator_write_ext_ram(Emulator*, FileData*);
 
@@ -239,9 +327,24 @@ Result emulator_write_ext_ram_to_file(Emulator*, const char* filename);
 EmulatorEvent emulator_step(Emulator*);
 EmulatorEvent emulator_run_until(Emulator*, Ticks until_ticks);
 
-ApuLog* emulator_get_apu_log(Emulator*);
+/* APU register writes are logged while EmulatorConfig.log_apu_writes is set,
+ * and always during initialization. The log grows until it is drained. */
+size_t emulator_get_apu_log_count(Emulator*);
+/* Move up to |max_count| of the oldest logged writes to |writes|; returns the
+ * number moved. */
+size_t emulator_drain_apu_log(Emulator*, ApuWrite* writes, size_t max_count);
 void emulator_reset_apu_log(Emulator*);
 
+/* Drain the log to a file: APU_LOG_FILE_HEADER as a little-endian u32, then
+ * one record per write. Each record is the ticks since the previously drained
+ * write (or the last state load) as a LEB128 number, then |addr| and
+ * |value|. */
+Result emulator_write_apu_log_to_file(Emulator*, const char* filename);
+
+EmulatorProfile emulator_get_profile(Emulator*);
+void emulator_reset_profile(Emulator*);
+const char* emulator_get_profile_kind_name(EmulatorProfileKind);
+
 #ifdef __cplusplus
 }
 #endif
@@ -31,6 +31,8 @@ struct HostUI {
   void update_mouse_cursor();
   void set_palette(RGBA palette[4]);
   void enable_palette(bool enabled);
+  void set_palette_table(HostTexture*, const RGBA* palettes, int count);
+  void set_use_palette(int value);
 
   static void set_clipboard_text(void* user_data, const char* text);
   static const char* get_clipboard_text(void* user_data);
@@ -49,6 +51,10 @@ struct HostUI {
   GLint uSampler;
   GLint uUsePalette;
   GLint uPalette;
+  GLint uPaletteTable;
+  bool palette_enabled;
+  int use_palette;
+  intptr_t palette_table_texture;
 
   // Global so it can be accessed by render_draw_lists callback, which has no
   // user_data pointer.
@@ -70,7 +76,10 @@ HostUI::HostUI(SDL_Window* window)
       ebo(0),
       program(0),
       uProjMatrix(0),
-      uSampler(0) {
+      uSampler(0),
+      palette_enabled(false),
+      use_palette(0),
+      palette_table_texture(0) {
   s_ui = this;
 }
 
@@ -117,6 +126,8 @@ Result HostUI::init() {
 }
 
 Result HostUI::init_gl() {
+  static_assert(HOST_PALETTE_TABLE_SIZE * 4 == 128,
+                "uPaletteTable size must match HOST_PALETTE_TABLE_SIZE");
   static const char* s_vertex_shader =
       "in vec2 aPos;\n"
       "in vec2 aUV;\n"
@@ -136,11 +147,17 @@ Result HostUI::init_gl() {
       "out vec4 oColor;\n"
       "uniform int uUsePalette;\n"
       "uniform vec4 uPalette[4];\n"
+      "uniform vec4 uPaletteTable[128];\n"
       "uniform sampler2D uSampler;\n"
       "void main(void) {\n"
-      "  vec4 color = vColor * texture(uSampler, vUV);\n"
-      "  if (uUsePalette != 0) {\n"
+      "  vec4 texel = texture(uSampler, vUV);\n"
+      "  vec4 color = vColor * texel;\n"
+      "  if (uUsePalette == 1) {\n"
       "    color = uPalette[int(clamp(color.x * 256.0, 0.0, 3.0))];\n"
+      "  } else if (uUsePalette == 2) {\n"
+      "    int index = int(clamp(texel.x * 256.0, 0.0, 3.0));\n"
+      "    int palette = int(vColor.x * 255.0 + 0.5);\n"
+      "    color = uPaletteTable[palette * 4 + index];\n"
       "  }\n"
       "  oColor = color;\n"
       "}\n";
@@ -162,6 +179,7 @@ Result HostUI::init_gl() {
   uSampler = glGetUniformLocation(program, "uSampler");
   uUsePalette = glGetUniformLocation(program, "uUsePalette");
   uPalette = glGetUniformLocation(program, "uPalette[0]");
+  uPaletteTable = glGetUniformLocation(program, "uPaletteTable[0]");
 
   glGenVertexArrays(1, &vao);
   glBindVertexArray(vao);
@@ -340,21 +358,40 @@ void HostUI::update_mouse_cursor() {
   }
 }
 
+static void rgba_to_vec4(const RGBA* colors, int count, GLfloat* out) {
+  for (int i = 0; i < count; ++i) {
+    out[i * 4 + 0] = ((colors[i] >> 0) & 255) / 255.0f;
+    out[i * 4 + 1] = ((colors[i] >> 8) & 255) / 255.0f;
+    out[i * 4 + 2] = ((colors[i] >> 16) & 255) / 255.0f;
+    out[i * 4 + 3] = 1.0f;
+  }
+}
+
 void HostUI::set_palette(RGBA palette[4]) {
   GLfloat p[16];
-  for (int i = 0; i < 4; ++i) {
-    p[i * 4 + 0] = ((palette[i] >> 0) & 255) / 255.0f;
-    p[i * 4 + 1] = ((palette[i] >> 8) & 255) / 255.0f;
-    p[i * 4 + 2] = ((palette[i] >> 16) & 255) / 255.0f;
-    p[i * 4 + 3] = 1.0f;
-  }
+  rgba_to_vec4(palette, 4, p);
   glUseProgram(program);
   glUniform4fv(uPalette, 4, p);
 }
 
 void HostUI::enable_palette(bool enabled) {
+  palette_enabled = enabled;
+  set_use_palette(enabled ? 1 : 0);
+}
+
+void HostUI::set_use_palette(int value) {
   glUseProgram(program);
-  glUniform1i(uUsePalette, enabled ? 1 : 0);
+  glUniform1i(uUsePalette, value);
+  use_palette = value;
+}
+
+void HostUI::set_palette_table(HostTexture* texture, const RGBA* palettes,
+                               int count) {
+  GLfloat p[HOST_PALETTE_TABLE_SIZE * 4 * 4];
+  rgba_to_vec4(palettes, count * 4, p);
+  glUseProgram(program);
+  glUniform4fv(uPaletteTable, count * 4, p);
+  palette_table_texture = texture->handle;
 }
 
 void HostUI::render_draw_lists(ImDrawData* draw_data) {
@@ -397,6 +434,17 @@ void HostUI::render_draw_lists(ImDrawData* draw_data) {
       if (cmd->UserCallback) {
         cmd->UserCallback(cmd_list, cmd);
       } else {
+        // Draws of the palette table texture use the table, unless a callback
+        // has already chosen a single palette.
+        int value = 0;
+        if (palette_enabled) {
+          value = 1;
+        } else if ((intptr_t)cmd->TextureId == palette_table_texture) {
+          value = 2;
+        }
+        if (value != use_palette) {
+          set_use_palette(value);
+        }
         glBindTexture(GL_TEXTURE_2D, (GLuint)(intptr_t)cmd->TextureId);
         glScissor((int)cmd->ClipRect.x, (int)(fb_height - cmd->ClipRect.w),
                   (int)(cmd->ClipRect.z - cmd->ClipRect.x),
@@ -457,6 +505,11 @@ void host_ui_enable_palette(struct HostUI* ui, Bool enabled) {
   ui->enable_palette(enabled);
 }
 
+void host_ui_set_palette_table(struct HostUI* ui, HostTexture* texture,
+                               const RGBA* palettes, int count) {
+  ui->set_palette_table(texture, palettes, count);
+}
+
 void host_ui_render_screen_overlay(struct HostUI* ui, HostTexture* tex) {
   // TODO(binji)
   assert(0);
@@ -193,6 +193,11 @@ void host_ui_enable_palette(struct HostUI* ui, Bool enabled) {
   glUniform1i(ui->uUsePalette, enabled ? 1 : 0);
 }
 
+void host_ui_set_palette_table(struct HostUI* ui, struct HostTexture* texture,
+                               const RGBA* palettes, int count) {
+  /* The simple UI never draws indexed textures. */
+}
+
 void host_ui_render_screen_overlay(struct HostUI* ui, HostTexture* tex) {
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -32,10 +32,15 @@ typedef f32 HostAudioSample;
 #define AUDIO_SPEC_FORMAT AUDIO_F32
 #define AUDIO_SPEC_CHANNELS 2
 #define AUDIO_SPEC_SAMPLE_SIZE sizeof(HostAudioSample)
-#define AUDIO_FRAME_SIZE (AUDIO_SPEC_SAMPLE_SIZE * AUDIO_SPEC_CHANNELS)
 #define AUDIO_CONVERT_SAMPLE_FROM_U8(X, fvol) ((fvol) * (X) * (1 / 255.0f))
 #define AUDIO_TARGET_QUEUED_SIZE (2 * host->audio.spec.size)
 #define AUDIO_MAX_QUEUED_SIZE (5 * host->audio.spec.size)
+/* The emulator's output rate is adjusted by at most this fraction to keep the
+ * ring near AUDIO_TARGET_QUEUED_SIZE. This is enough to absorb e.g. a 60Hz
+ * display driving the ~59.73Hz GB, at a pitch change of under 20 cents. */
+#define AUDIO_RATE_MAX_DELTA 0.01
+#define AUDIO_RATE_P_GAIN 0.005
+#define AUDIO_RATE_I_GAIN 0.0002
 
 typedef struct {
   GLint internal_format;
@@ -43,18 +48,73 @@ typedef struct {
   GLenum type;
 } GLTextureFormat;
 
+/* Lock-free ring of samples in the device's format. host_render_audio is the
+ * only writer and host_audio_callback (on SDL's audio thread) the only
+ * reader. |read| and |write| are free-running byte counts; each is only
+ * stored by its own side. */
+typedef struct {
+  u8* data;
+  u32 capacity; /* Power of two, in bytes. */
+  SDL_atomic_t read;
+  SDL_atomic_t write;
+  SDL_atomic_t underruns; /* Callbacks that ran out of samples. */
+  u32 overruns;           /* Frames dropped because the ring was full. */
+  u32 reported_underruns, reported_overruns;
+} AudioRing;
+
 typedef struct {
   SDL_AudioDeviceID dev;
   SDL_AudioSpec spec;
-  u8* buffer; /* Size is spec.size. */
+  AudioRing ring;
+  u32 frame_size; /* Size of one device frame, in bytes. */
+  f64 rate_integral; /* Accumulated rate correction; see AUDIO_RATE_*. */
   Bool ready;
   f32 volume; /* [0..1] */
 } Audio;
 
+#define REWIND_QUEUE_SIZE 4
+
+/* Captured states waiting to be appended to the rewind buffer by the worker
+ * thread. There is one producer (the emulator thread) and one consumer (the
+ * worker), so each index is only touched by one side; |free_sem| and
+ * |full_sem| count the empty and captured slots. */
+typedef struct {
+  SDL_Thread* thread;
+  SDL_sem* free_sem;
+  SDL_sem* full_sem;
+  SDL_atomic_t quit;
+  RewindCapture slots[REWIND_QUEUE_SIZE];
+  int write_index;
+  int read_index;
+} RewindQueue;
+
+#define CHANNEL_CAPTURE_RING_SIZE MEGABYTES(1) /* Power of two. */
+#define CHANNEL_CAPTURE_CHUNK_FRAMES 4096
+#define WAV_HEADER_SIZE 44
+
+/* Per-channel samples waiting to be written to disk by the capture thread.
+ * Like AudioRing, |read| and |write| are free-running byte counts, each only
+ * stored by its own side; the emulator thread never waits on the writer, so
+ * frames are dropped if the ring is full. */
+typedef struct {
+  SDL_Thread* thread;
+  SDL_sem* sem; /* Posted when frames are added, or to quit. */
+  SDL_atomic_t quit;
+  u8* data;
+  SDL_atomic_t read;
+  SDL_atomic_t write;
+  u32 dropped_frames;
+  u32 frequency;    /* Nominal output rate, fixed for the whole capture. */
+  u32 freq_counter; /* Used for resampling; [0..AudioBuffer.frequency). */
+  u32 data_size; /* Bytes written to each file after the header. */
+  FILE* files[APU_CHANNEL_COUNT];
+} ChannelCapture;
+
 typedef struct {
   RewindResult rewind_result;
   JoypadPlayback joypad_playback;
   Bool rewinding;
+  Bool replaying; /* Running frames that won't be shown; don't render. */
 } RewindState;
 
 typedef struct Host {
@@ -72,9 +132,12 @@ typedef struct Host {
   HostTexture* sgb_fb_texture;
   JoypadBuffer* joypad_buffer;
   RewindBuffer* rewind_buffer;
+  RewindQueue rewind_queue;
+  ChannelCapture channel_capture;
   RewindState rewind_state;
   JoypadPlayback joypad_playback;
   Ticks last_ticks;
+  u32 frames_until_present; /* Frames to skip before the next upload. */
   Bool key_state[HOST_KEYCODE_COUNT];
 } Host;
 
@@ -82,6 +145,16 @@ static Emulator* host_get_emulator(Host* host) {
   return host->hook_ctx.e;
 }
 
+static u32 host_get_fast_forward_frames(Host* host) {
+  return MAX(1, host->config.fast_forward_frames);
+}
+
+/* The emulator's nominal output rate; with fast-forward, each emulated
+ * second is played in 1/N seconds. */
+static u32 host_get_audio_frequency(Host* host) {
+  return host->audio.spec.freq / host_get_fast_forward_frames(host);
+}
+
 static Result host_init_video(Host* host) {
   Emulator* e = host_get_emulator(host);
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
@@ -126,21 +199,59 @@ f64 host_get_time_ms(Host* host) {
   return (f64)(now - host->start_counter) * 1000 / host->performance_frequency;
 }
 
+static SDL_AudioFormat host_get_audio_spec_format(Host* host) {
+  switch (emulator_get_audio_buffer(host_get_emulator(host))->format) {
+    case AUDIO_FORMAT_S16: return AUDIO_S16SYS;
+    case AUDIO_FORMAT_F32: return AUDIO_F32SYS;
+    /* U8 samples are converted by host_render_audio. */
+    default: return AUDIO_SPEC_FORMAT;
+  }
+}
+
+static u32 audio_ring_used(AudioRing* ring) {
+  return (u32)SDL_AtomicGet(&ring->write) - (u32)SDL_AtomicGet(&ring->read);
+}
+
+static void host_audio_callback(void* user_data, u8* stream, int len) {
+  Host* host = user_data;
+  Audio* audio = &host->audio;
+  AudioRing* ring = &audio->ring;
+  u32 read = SDL_AtomicGet(&ring->read);
+  u32 size = MIN((u32)len, audio_ring_used(ring));
+  size -= size % audio->frame_size;
+  u32 offset = read & (ring->capacity - 1);
+  u32 first = MIN(size, ring->capacity - offset);
+  memcpy(stream, ring->data + offset, first);
+  memcpy(stream + first, ring->data, size - first);
+  SDL_AtomicSet(&ring->read, read + size);
+  if (size < (u32)len) {
+    memset(stream + size, audio->spec.silence, len - size);
+    SDL_AtomicIncRef(&ring->underruns);
+  }
+}
+
 static Result host_init_audio(Host* host) {
   host->audio.ready = FALSE;
   host_set_audio_volume(host, host->init.audio_volume);
   SDL_AudioSpec want;
   want.freq = host->init.audio_frequency;
-  want.format = AUDIO_SPEC_FORMAT;
+  want.format = host_get_audio_spec_format(host);
   want.channels = AUDIO_SPEC_CHANNELS;
   want.samples = host->init.audio_frames * AUDIO_SPEC_CHANNELS;
-  want.callback = NULL;
+  want.callback = host_audio_callback;
   want.userdata = host;
   host->audio.dev = SDL_OpenAudioDevice(NULL, 0, &want, &host->audio.spec, 0);
   CHECK_MSG(host->audio.dev != 0, "SDL_OpenAudioDevice failed.\n");
+  host->audio.frame_size =
+      SDL_AUDIO_BITSIZE(host->audio.spec.format) / 8 * AUDIO_SPEC_CHANNELS;
 
-  host->audio.buffer = xcalloc(1, host->audio.spec.size);
-  CHECK_MSG(host->audio.buffer != NULL, "Audio buffer allocation failed.\n");
+  AudioRing* ring = &host->audio.ring;
+  ring->capacity = 1;
+  while (ring->capacity < AUDIO_MAX_QUEUED_SIZE) {
+    ring->capacity <<= 1;
+  }
+  ring->data = xcalloc(1, ring->capacity);
+  CHECK_MSG(ring->data != NULL, "Audio buffer allocation failed.\n");
   return OK;
   ON_ERROR_RETURN;
 }
@@ -207,45 +318,87 @@ void host_end_video(Host* host) {
 }
 
 void host_reset_audio(Host* host) {
+  AudioRing* ring = &host->audio.ring;
   host->audio.ready = FALSE;
-  SDL_ClearQueuedAudio(host->audio.dev);
+  host->audio.rate_integral = 0;
+  emulator_set_audio_frequency(host_get_emulator(host),
+                               host_get_audio_frequency(host));
+  /* The callback doesn't run while paused, so the ring can be emptied. */
   SDL_PauseAudioDevice(host->audio.dev, 1);
+  SDL_AtomicSet(&ring->read, SDL_AtomicGet(&ring->write));
 }
 
 void host_set_audio_volume(Host* host, f32 volume) {
   host->audio.volume = CLAMP(volume, 0, 1);
+  emulator_set_audio_volume(host_get_emulator(host), host->audio.volume);
+}
+
+/* Nudge the emulator's output rate so the ring stays near its target fill,
+ * given that |used| bytes are queued after adding the latest buffer. */
+static void host_update_audio_rate(Host* host, u32 used) {
+  Audio* audio = &host->audio;
+  /* Positive when the ring is too empty, i.e. more samples are needed. */
+  f64 error = ((f64)AUDIO_TARGET_QUEUED_SIZE - used) / AUDIO_TARGET_QUEUED_SIZE;
+  error = CLAMP(error, -1, 1);
+  audio->rate_integral =
+      CLAMP(audio->rate_integral + AUDIO_RATE_I_GAIN * error,
+            -AUDIO_RATE_MAX_DELTA, AUDIO_RATE_MAX_DELTA);
+  f64 delta = CLAMP(AUDIO_RATE_P_GAIN * error + audio->rate_integral,
+                    -AUDIO_RATE_MAX_DELTA, AUDIO_RATE_MAX_DELTA);
+  emulator_set_audio_frequency(
+      host_get_emulator(host),
+      (u32)(host_get_audio_frequency(host) * (1 + delta) + 0.5));
 }
 
 void host_render_audio(Host* host) {
   Emulator* e = host_get_emulator(host);
   Audio* audio = &host->audio;
+  AudioRing* ring = &audio->ring;
   AudioBuffer* audio_buffer = emulator_get_audio_buffer(e);
 
-  size_t src_frames = audio_buffer_get_frames(audio_buffer);
-  size_t max_dst_frames = audio->spec.size / AUDIO_FRAME_SIZE;
-  size_t frames = MIN(src_frames, max_dst_frames);
-  u8* src = audio_buffer->data;
-  HostAudioSample* dst = (HostAudioSample*)audio->buffer;
-  HostAudioSample* dst_end = dst + frames * AUDIO_SPEC_CHANNELS;
-  assert((u8*)dst_end <= audio->buffer + audio->spec.size);
-  f32 volume = audio->volume;
-  size_t i;
-  for (i = 0; i < frames; i++) {
-    assert(dst + 2 <= dst_end);
-    *dst++ = AUDIO_CONVERT_SAMPLE_FROM_U8(*src++, volume);
-    *dst++ = AUDIO_CONVERT_SAMPLE_FROM_U8(*src++, volume);
-  }
-  u32 queued_size = SDL_GetQueuedAudioSize(audio->dev);
-  if (queued_size < AUDIO_MAX_QUEUED_SIZE) {
-    u32 buffer_size = (u8*)dst_end - (u8*)audio->buffer;
-    SDL_QueueAudio(audio->dev, audio->buffer, buffer_size);
-    HOOK(audio_add_buffer, queued_size, queued_size + buffer_size);
-    queued_size += buffer_size;
-  }
-  if (!audio->ready && queued_size >= AUDIO_TARGET_QUEUED_SIZE) {
-    HOOK(audio_buffer_ready, queued_size);
+  u32 src_frames = audio_buffer_get_frames(audio_buffer);
+  u32 used = audio_ring_used(ring);
+  u32 frames = MIN(src_frames, (ring->capacity - used) / audio->frame_size);
+  ring->overruns += src_frames - frames;
+
+  u32 write = SDL_AtomicGet(&ring->write);
+  u32 size = frames * audio->frame_size;
+  u32 offset = write & (ring->capacity - 1);
+  if (audio_buffer->format == AUDIO_FORMAT_U8) {
+    u8* src = audio_buffer->data;
+    f32 volume = audio->volume;
+    u32 i;
+    for (i = 0; i < frames * AUDIO_SPEC_CHANNELS; ++i) {
+      /* The capacity is a multiple of the frame size, so a wrap can only
+       * happen between frames. */
+      HostAudioSample* dst = (HostAudioSample*)(ring->data + offset);
+      *dst = AUDIO_CONVERT_SAMPLE_FROM_U8(*src++, volume);
+      offset = (offset + AUDIO_SPEC_SAMPLE_SIZE) & (ring->capacity - 1);
+    }
+  } else {
+    /* Already in the device's format, with the volume applied. */
+    u32 first = MIN(size, ring->capacity - offset);
+    memcpy(ring->data + offset, audio_buffer->data, first);
+    memcpy(ring->data, audio_buffer->data + first, size - first);
+  }
+  SDL_AtomicSet(&ring->write, write + size);
+  HOOK(audio_add_buffer, used, used + size);
+  used += size;
+
+  if (!audio->ready && used >= AUDIO_TARGET_QUEUED_SIZE) {
+    HOOK(audio_buffer_ready, used);
     audio->ready = TRUE;
     SDL_PauseAudioDevice(audio->dev, 0);
+  } else if (audio->ready) {
+    host_update_audio_rate(host, used);
+  }
+
+  u32 underruns = SDL_AtomicGet(&ring->underruns);
+  if (underruns != ring->reported_underruns ||
+      ring->overruns != ring->reported_overruns) {
+    HOOK(audio_xrun, underruns, ring->overruns);
+    ring->reported_underruns = underruns;
+    ring->reported_overruns = ring->overruns;
   }
 }
 
@@ -302,19 +455,259 @@ static Result host_init_joypad(Host* host, Emulator* e) {
   ON_ERROR_RETURN;
 }
 
+static int rewind_worker(void* user_data) {
+  Host* host = user_data;
+  RewindQueue* queue = &host->rewind_queue;
+  while (1) {
+    SDL_SemWait(queue->full_sem);
+    if (SDL_AtomicGet(&queue->quit)) {
+      break;
+    }
+    rewind_append_capture(host->rewind_buffer,
+                          &queue->slots[queue->read_index]);
+    queue->read_index = (queue->read_index + 1) % REWIND_QUEUE_SIZE;
+    SDL_SemPost(queue->free_sem);
+  }
+  return 0;
+}
+
+static Result host_init_rewind(Host* host, Emulator* e) {
+  host->rewind_buffer = rewind_new(&host->init.rewind, e);
+  if (!host->init.use_rewind_thread) {
+    return OK;
+  }
+
+  RewindQueue* queue = &host->rewind_queue;
+  int i;
+  for (i = 0; i < REWIND_QUEUE_SIZE; ++i) {
+    rewind_capture_init(&queue->slots[i]);
+  }
+  queue->free_sem = SDL_CreateSemaphore(REWIND_QUEUE_SIZE);
+  queue->full_sem = SDL_CreateSemaphore(0);
+  CHECK_MSG(queue->free_sem && queue->full_sem,
+            "SDL_CreateSemaphore failed.\n");
+  queue->thread = SDL_CreateThread(rewind_worker, "rewind", host);
+  CHECK_MSG(queue->thread != NULL, "SDL_CreateThread failed.\n");
+  return OK;
+  ON_ERROR_RETURN;
+}
+
+/* Wait for the worker to append every queued state, so the rewind buffer can
+ * be used from this thread. */
+static void host_drain_rewind_queue(Host* host) {
+  RewindQueue* queue = &host->rewind_queue;
+  if (!queue->thread) {
+    return;
+  }
+  int i;
+  for (i = 0; i < REWIND_QUEUE_SIZE; ++i) {
+    SDL_SemWait(queue->free_sem);
+  }
+  for (i = 0; i < REWIND_QUEUE_SIZE; ++i) {
+    SDL_SemPost(queue->free_sem);
+  }
+}
+
+static void host_delete_rewind(Host* host) {
+  RewindQueue* queue = &host->rewind_queue;
+  if (queue->thread) {
+    host_drain_rewind_queue(host);
+    SDL_AtomicSet(&queue->quit, 1);
+    SDL_SemPost(queue->full_sem);
+    SDL_WaitThread(queue->thread, NULL);
+  }
+  if (queue->free_sem) {
+    SDL_DestroySemaphore(queue->free_sem);
+  }
+  if (queue->full_sem) {
+    SDL_DestroySemaphore(queue->full_sem);
+  }
+  if (host->init.use_rewind_thread) {
+    int i;
+    for (i = 0; i < REWIND_QUEUE_SIZE; ++i) {
+      rewind_capture_delete(&queue->slots[i]);
+    }
+  }
+  rewind_delete(host->rewind_buffer);
+}
+
+/* 8-bit mono PCM; sizes are patched by host_delete_channel_capture. */
+static void write_wav_header(FILE* f, u32 frequency, u32 data_size) {
+  u8 header[WAV_HEADER_SIZE];
+  u8* p = header;
+#define WRITE_U16(X) *p++ = (u8)(X), *p++ = (u8)((X) >> 8)
+#define WRITE_U32(X) WRITE_U16((u16)(X)), WRITE_U16((u16)((X) >> 16))
+#define WRITE_TAG(X) memcpy(p, X, 4), p += 4
+  WRITE_TAG("RIFF");
+  WRITE_U32(WAV_HEADER_SIZE - 8 + data_size);
+  WRITE_TAG("WAVE");
+  WRITE_TAG("fmt ");
+  WRITE_U32(16);        /* fmt chunk size. */
+  WRITE_U16(1);         /* PCM. */
+  WRITE_U16(1);         /* Channels. */
+  WRITE_U32(frequency); /* Sample rate. */
+  WRITE_U32(frequency); /* Byte rate. */
+  WRITE_U16(1);         /* Block align. */
+  WRITE_U16(8);         /* Bits per sample. */
+  WRITE_TAG("data");
+  WRITE_U32(data_size);
+#undef WRITE_U16
+#undef WRITE_U32
+#undef WRITE_TAG
+  assert(p == header + WAV_HEADER_SIZE);
+  fwrite(header, WAV_HEADER_SIZE, 1, f);
+}
+
+static int channel_capture_worker(void* user_data) {
+  ChannelCapture* capture = user_data;
+  u8 samples[APU_CHANNEL_COUNT][CHANNEL_CAPTURE_CHUNK_FRAMES];
+  while (1) {
+    SDL_SemWait(capture->sem);
+    /* Read |quit| first, so everything written before it was set is saved. */
+    Bool quit = SDL_AtomicGet(&capture->quit);
+    u32 read = SDL_AtomicGet(&capture->read);
+    u32 frames =
+        ((u32)SDL_AtomicGet(&capture->write) - read) / APU_CHANNEL_COUNT;
+    while (frames) {
+      u32 count = MIN(frames, CHANNEL_CAPTURE_CHUNK_FRAMES);
+      u32 i;
+      int j;
+      for (i = 0; i < count; ++i) {
+        for (j = 0; j < APU_CHANNEL_COUNT; ++j) {
+          samples[j][i] =
+              capture->data[read++ & (CHANNEL_CAPTURE_RING_SIZE - 1)];
+        }
+      }
+      SDL_AtomicSet(&capture->read, read);
+      for (j = 0; j < APU_CHANNEL_COUNT; ++j) {
+        fwrite(samples[j], count, 1, capture->files[j]);
+      }
+      capture->data_size += count;
+      frames -= count;
+    }
+    if (quit) {
+      break;
+    }
+  }
+  return 0;
+}
+
+static Result host_init_channel_capture(Host* host, Emulator* e) {
+  const char* prefix = host->init.channel_capture_prefix;
+  if (!prefix) {
+    return OK;
+  }
+
+  ChannelCapture* capture = &host->channel_capture;
+  CHECK_MSG(emulator_get_audio_buffer(e)->channel_data != NULL,
+            "Channel capture requires EmulatorInit.capture_channels.\n");
+  capture->frequency = host->audio.spec.freq;
+  int i;
+  for (i = 0; i < APU_CHANNEL_COUNT; ++i) {
+    char filename[1024];
+    snprintf(filename, sizeof(filename), "%s-ch%d.wav", prefix, i + 1);
+    capture->files[i] = fopen(filename, "wb");
+    CHECK_MSG(capture->files[i] != NULL, "Unable to open file \"%s\".\n",
+              filename);
+    write_wav_header(capture->files[i], capture->frequency, 0);
+  }
+  capture->data = xmalloc(CHANNEL_CAPTURE_RING_SIZE);
+  CHECK_MSG(capture->data != NULL, "Channel capture allocation failed.\n");
+  capture->sem = SDL_CreateSemaphore(0);
+  CHECK_MSG(capture->sem != NULL, "SDL_CreateSemaphore failed.\n");
+  capture->thread =
+      SDL_CreateThread(channel_capture_worker, "channel capture", capture);
+  CHECK_MSG(capture->thread != NULL, "SDL_CreateThread failed.\n");
+  return OK;
+  ON_ERROR_RETURN;
+}
+
+/* Hand the channel samples from the last full audio buffer to the writer.
+ * They were generated at the emulator's current output rate, which is lowered
+ * while fast-forwarding and nudged by host_update_audio_rate, so they're
+ * resampled to |capture->frequency| to keep the files in real time. Must run
+ * before host_render_audio changes the rate. */
+static void host_capture_channels(Host* host) {
+  ChannelCapture* capture = &host->channel_capture;
+  if (!capture->thread) {
+    return;
+  }
+  Emulator* e = host_get_emulator(host);
+  AudioBuffer* audio_buffer = emulator_get_audio_buffer(e);
+  u32 src_frames = audio_buffer_get_channel_frames(audio_buffer);
+  const u8* src = audio_buffer->channel_data;
+  u32 write = SDL_AtomicGet(&capture->write);
+  u32 read = SDL_AtomicGet(&capture->read);
+  u32 i, j;
+  for (i = 0; i < src_frames; ++i, src += APU_CHANNEL_COUNT) {
+    /* Each source frame is repeated or skipped as needed. */
+    capture->freq_counter += capture->frequency;
+    for (; capture->freq_counter >= audio_buffer->frequency;
+         capture->freq_counter -= audio_buffer->frequency) {
+      if (write - read > CHANNEL_CAPTURE_RING_SIZE - APU_CHANNEL_COUNT) {
+        capture->dropped_frames++;
+        continue;
+      }
+      for (j = 0; j < APU_CHANNEL_COUNT; ++j) {
+        capture->data[write++ & (CHANNEL_CAPTURE_RING_SIZE - 1)] = src[j];
+      }
+    }
+  }
+  SDL_AtomicSet(&capture->write, write);
+  SDL_SemPost(capture->sem);
+}
+
+static void host_delete_channel_capture(Host* host) {
+  ChannelCapture* capture = &host->channel_capture;
+  if (capture->thread) {
+    SDL_AtomicSet(&capture->quit, 1);
+    SDL_SemPost(capture->sem);
+    SDL_WaitThread(capture->thread, NULL);
+  }
+  if (capture->sem) {
+    SDL_DestroySemaphore(capture->sem);
+  }
+  int i;
+  for (i = 0; i < APU_CHANNEL_COUNT; ++i) {
+    if (capture->files[i]) {
+      fseek(capture->files[i], 0, SEEK_SET);
+      write_wav_header(capture->files[i], capture->frequency,
+                       capture->data_size);
+      fclose(capture->files[i]);
+    }
+  }
+  if (capture->dropped_frames) {
+    PRINT_ERROR("warning: channel capture dropped %u frames.\n",
+                capture->dropped_frames);
+  }
+  xfree(capture->data);
+}
+
 static void append_rewind_state(Host* host) {
   if (host->rewind_state.rewinding) {
     return;
   }
 
-  rewind_append(host->rewind_buffer, host_get_emulator(host));
+  RewindQueue* queue = &host->rewind_queue;
+  if (!queue->thread) {
+    rewind_append(host->rewind_buffer, host_get_emulator(host));
+    return;
+  }
+
+  /* Only blocks if the worker has fallen REWIND_QUEUE_SIZE frames behind. */
+  SDL_SemWait(queue->free_sem);
+  rewind_capture(&queue->slots[queue->write_index], host_get_emulator(host));
+  queue->write_index = (queue->write_index + 1) % REWIND_QUEUE_SIZE;
+  SDL_SemPost(queue->full_sem);
 }
 
 Ticks host_get_rewind_oldest_ticks(struct Host* host) {
+  host_drain_rewind_queue(host);
   return rewind_get_oldest_ticks(host->rewind_buffer);
 }
 
 Ticks host_get_rewind_newest_ticks(struct Host* host) {
+  host_drain_rewind_queue(host);
   return rewind_get_newest_ticks(host->rewind_buffer);
 }
 
@@ -323,6 +716,7 @@ JoypadStats host_get_joypad_stats(struct Host* host) {
 }
 
 RewindStats host_get_rewind_stats(struct Host* host) {
+  host_drain_rewind_queue(host);
   return rewind_get_stats(host->rewind_buffer);
 }
 
@@ -338,19 +732,41 @@ error:
   return result;
 }
 
+/* The emulator only renders the frames that will be uploaded. */
+static void host_set_frames_until_present(Host* host, u32 frames) {
+  Emulator* e = host_get_emulator(host);
+  EmulatorConfig emu_config = emulator_get_config(e);
+  host->frames_until_present = frames;
+  emu_config.skip_render = frames != 0;
+  emulator_set_config(e, &emu_config);
+}
+
 static void host_handle_event(Host* host, EmulatorEvent event) {
   Emulator* e = host_get_emulator(host);
   if (event & EMULATOR_EVENT_NEW_FRAME) {
-    host_upload_texture(host, host->fb_texture, SCREEN_WIDTH, SCREEN_HEIGHT,
-                        *emulator_get_frame_buffer(e));
-    if (host->init.use_sgb_border) {
-      host_upload_texture(host, host->sgb_fb_texture, SGB_SCREEN_WIDTH,
-                          SGB_SCREEN_HEIGHT, *emulator_get_sgb_frame_buffer(e));
+    if (host->rewind_state.replaying) {
+      /* Rendering stays off until host_rewind_to_ticks is done replaying. */
+    } else if (host->frames_until_present == 0) {
+      host_upload_texture(host, host->fb_texture, SCREEN_WIDTH, SCREEN_HEIGHT,
+                          *emulator_get_frame_buffer(e));
+      if (host->init.use_sgb_border) {
+        host_upload_texture(host, host->sgb_fb_texture, SGB_SCREEN_WIDTH,
+                            SGB_SCREEN_HEIGHT,
+                            *emulator_get_sgb_frame_buffer(e));
+      }
+      host_set_frames_until_present(host,
+                                    host_get_fast_forward_frames(host) - 1);
+    } else {
+      host_set_frames_until_present(host, host->frames_until_present - 1);
     }
 
     append_rewind_state(host);
   }
   if (event & EMULATOR_EVENT_AUDIO_BUFFER_FULL) {
+    /* Frames replayed while rewinding were already captured. */
+    if (!host->rewind_state.rewinding) {
+      host_capture_channels(host);
+    }
     host_render_audio(host);
     HOOK0(audio_buffer_full);
   }
@@ -375,6 +791,7 @@ void host_begin_rewind(Host* host) {
 
 Result host_rewind_to_ticks(Host* host, Ticks ticks) {
   assert(host->rewind_state.rewinding);
+  host_drain_rewind_queue(host);
 
   RewindResult* result = &host->rewind_state.rewind_result;
   CHECK(SUCCESS(rewind_to_ticks(host->rewind_buffer, ticks, result)));
@@ -388,6 +805,16 @@ Result host_rewind_to_ticks(Host* host, Ticks ticks) {
     JoypadCallbackInfo old_jci = emulator_get_joypad_callback(e);
     emulator_set_joypad_playback_callback(e, host->joypad_buffer,
                                           &host->rewind_state.joypad_playback);
+    /* Only the last frame finished before |ticks| is shown, and it can start
+     * up to two frames earlier, so don't render anything before that. */
+    Ticks render_ticks = ticks - MIN(ticks, 2 * PPU_FRAME_TICKS);
+    if (emulator_get_ticks(e) < render_ticks) {
+      host->rewind_state.replaying = TRUE;
+      host_set_frames_until_present(host, 1);
+      host_run_until_ticks(host, render_ticks);
+      host->rewind_state.replaying = FALSE;
+    }
+    host_set_frames_until_present(host, 0);
     host_run_until_ticks(host, ticks);
     /* Restore old joypad callback. */
     emulator_set_joypad_callback(e, old_jci.callback, old_jci.user_data);
@@ -430,7 +857,8 @@ Result host_init(Host* host, Emulator* e) {
   CHECK(SUCCESS(host_init_video(host)));
   CHECK(SUCCESS(host_init_audio(host)));
   host_init_joypad(host, e);
-  host->rewind_buffer = rewind_new(&host->init.rewind, e);
+  CHECK(SUCCESS(host_init_rewind(host, e)));
+  CHECK(SUCCESS(host_init_channel_capture(host, e)));
   host->last_ticks = emulator_get_ticks(e);
   return OK;
   ON_ERROR_RETURN;
@@ -439,7 +867,8 @@ Result host_init(Host* host, Emulator* e) {
 EmulatorEvent host_run_ms(struct Host* host, f64 delta_ms) {
   assert(!host->rewind_state.rewinding);
   Emulator* e = host_get_emulator(host);
-  Ticks delta_ticks = (Ticks)(delta_ms * CPU_TICKS_PER_SECOND / 1000);
+  Ticks delta_ticks = (Ticks)(delta_ms * CPU_TICKS_PER_SECOND / 1000) *
+                      host_get_fast_forward_frames(host);
   Ticks until_ticks = emulator_get_ticks(e) + delta_ticks;
   EmulatorEvent event = host_run_until_ticks(host, until_ticks);
   host->last_ticks = emulator_get_ticks(e);
@@ -476,10 +905,12 @@ void host_delete(Host* host) {
     host_destroy_texture(host, host->fb_texture);
     SDL_GL_DeleteContext(host->gl_context);
     SDL_DestroyWindow(host->window);
+    host_delete_rewind(host);
+    host_delete_channel_capture(host);
+    SDL_CloseAudioDevice(host->audio.dev);
     SDL_Quit();
     joypad_delete(host->joypad_buffer);
-    rewind_delete(host->rewind_buffer);
-    xfree(host->audio.buffer);
+    xfree(host->audio.ring.data);
     xfree(host);
   }
 }
@@ -490,6 +921,12 @@ void host_set_config(Host* host, const HostConfig* new_config) {
     host_reset_audio(host);
   }
 
+  if (host->config.fast_forward_frames != new_config->fast_forward_frames) {
+    host->config.fast_forward_frames = new_config->fast_forward_frames;
+    host_set_frames_until_present(host, 0);
+    host_reset_audio(host);
+  }
+
   if (host->config.fullscreen != new_config->fullscreen) {
     SDL_SetWindowFullscreen(host->window, new_config->fullscreen
                                               ? SDL_WINDOW_FULLSCREEN_DESKTOP
@@ -522,6 +959,12 @@ void host_enable_palette(Host* host, Bool enabled) {
   host_ui_enable_palette(host->ui, enabled);
 }
 
+void host_set_palette_table(Host* host, HostTexture* texture,
+                            const RGBA* palettes, int count) {
+  assert(count <= HOST_PALETTE_TABLE_SIZE);
+  host_ui_set_palette_table(host->ui, texture, palettes, count);
+}
+
 static u32 next_power_of_two(u32 n) {
   assert(n != 0);
   n--;
@@ -591,6 +1034,16 @@ void host_upload_texture(Host* host, HostTexture* texture, int w, int h,
                   gl_format.type, data);
 }
 
+void host_upload_sub_texture(Host* host, HostTexture* texture, int x, int y,
+                             int w, int h, const void* data) {
+  assert(x + w <= texture->width);
+  assert(y + h <= texture->height);
+  glBindTexture(GL_TEXTURE_2D, texture->handle);
+  GLTextureFormat gl_format = host_apply_texture_format(texture->format);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, gl_format.format,
+                  gl_format.type, data);
+}
+
 void host_destroy_texture(Host* host, HostTexture* texture) {
   GLuint tex = texture->handle;
   glDeleteTextures(1, &tex);
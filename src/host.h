@@ -115,6 +115,10 @@ typedef struct HostHooks {
                            int new_available);
   void (*audio_buffer_ready)(HostHookContext*, int new_available);
   void (*audio_buffer_full)(HostHookContext*);
+  /* Called when the total counts of device callbacks that ran out of samples
+   * (underruns) or of emulated frames dropped because the queue was full
+   * (overruns) change. */
+  void (*audio_xrun)(HostHookContext*, u32 underruns, u32 overruns);
   void (*key_down)(HostHookContext*, HostKeycode key);
   void (*key_up)(HostHookContext*, HostKeycode key);
 } HostHooks;
@@ -126,6 +130,10 @@ typedef struct HostInit {
   int audio_frames;
   f32 audio_volume;
   RewindInit rewind;
+  Bool use_rewind_thread; /* Compress rewind states on a worker thread. */
+  /* If set, write each channel to "<prefix>-chN.wav"; the emulator must be
+   * created with EmulatorInit.capture_channels. */
+  const char* channel_capture_prefix;
   const char* joypad_filename;
   Bool use_sgb_border;
 } HostInit;
@@ -133,6 +141,10 @@ typedef struct HostInit {
 typedef struct HostConfig {
   Bool no_sync;
   Bool fullscreen;
+  /* Emulate this many frames per displayed frame; 0 or 1 is normal speed.
+   * Frames that aren't displayed aren't rendered, and audio is generated at
+   * a proportionally lower rate so it still plays in real time. */
+  u32 fast_forward_frames;
 } HostConfig;
 
 typedef enum HostTextureFormat {
@@ -163,6 +175,12 @@ void host_begin_video(struct Host*);
 void host_end_video(struct Host*);
 void host_set_palette(struct Host*, RGBA palette[4]);
 void host_enable_palette(struct Host*, Bool enabled);
+/* Each texel of |texture| is a color index into one of |count| palettes of 4
+ * colors. The red channel of the vertex color chooses the palette, so draws
+ * with different palettes can be batched together. */
+#define HOST_PALETTE_TABLE_SIZE 32
+void host_set_palette_table(struct Host*, struct HostTexture*,
+                            const RGBA* palettes, int count);
 void host_render_screen_overlay(struct Host*, struct HostTexture*);
 
 /* Rewind support. */
@@ -186,6 +204,10 @@ HostTexture* host_get_frame_buffer_texture(struct Host*);
 HostTexture* host_create_texture(struct Host*, int w, int h, HostTextureFormat);
 void host_upload_texture(struct Host*, HostTexture*, int w, int h,
                          const void* data);
+/* Replace the |w|x|h| rectangle at |x|,|y| with |data|, which has no padding
+ * between rows. */
+void host_upload_sub_texture(struct Host*, HostTexture*, int x, int y, int w,
+                             int h, const void* data);
 void host_destroy_texture(struct Host*, HostTexture*);
 
 
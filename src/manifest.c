@@ -0,0 +1,151 @@
+#include "manifest.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A minimal JSON reader; just enough to parse the test manifest. */
+typedef struct {
+  const char* filename;
+  const char* p;
+  const char* end;
+  int line;
+} ManifestReader;
+
+static void skip_whitespace(ManifestReader* r) {
+  while (r->p < r->end && isspace((u8)*r->p)) {
+    if (*r->p == '\n') {
+      r->line++;
+    }
+    r->p++;
+  }
+}
+
+static Result expect_char(ManifestReader* r, char c) {
+  skip_whitespace(r);
+  CHECK_MSG(r->p < r->end && *r->p == c, "%s:%d: expected '%c'.\n",
+            r->filename, r->line, c);
+  r->p++;
+  return OK;
+  ON_ERROR_RETURN;
+}
+
+static Bool match_char(ManifestReader* r, char c) {
+  skip_whitespace(r);
+  if (r->p < r->end && *r->p == c) {
+    r->p++;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static Result read_string(ManifestReader* r, char** out_string) {
+  CHECK(SUCCESS(expect_char(r, '"')));
+  const char* begin = r->p;
+  while (r->p < r->end && *r->p != '"') {
+    CHECK_MSG(*r->p != '\\' && *r->p != '\n',
+              "%s:%d: escapes are not supported.\n", r->filename, r->line);
+    r->p++;
+  }
+  CHECK_MSG(r->p < r->end, "%s:%d: unterminated string.\n", r->filename,
+            r->line);
+  size_t len = r->p - begin;
+  char* string = xmalloc(len + 1);
+  memcpy(string, begin, len);
+  string[len] = 0;
+  r->p++;
+  *out_string = string;
+  return OK;
+  ON_ERROR_RETURN;
+}
+
+static Result read_int(ManifestReader* r, int* out_value) {
+  skip_whitespace(r);
+  CHECK_MSG(r->p < r->end && isdigit((u8)*r->p),
+            "%s:%d: expected integer.\n", r->filename, r->line);
+  int value = 0;
+  while (r->p < r->end && isdigit((u8)*r->p)) {
+    value = value * 10 + (*r->p++ - '0');
+  }
+  *out_value = value;
+  return OK;
+  ON_ERROR_RETURN;
+}
+
+static Result read_entry(ManifestReader* r, ManifestEntry* entry) {
+  ZERO_MEMORY(*entry);
+  CHECK(SUCCESS(expect_char(r, '[')));
+  CHECK(SUCCESS(read_string(r, &entry->suite)));
+  CHECK(SUCCESS(expect_char(r, ',')));
+  CHECK(SUCCESS(read_string(r, &entry->rom)));
+  CHECK(SUCCESS(expect_char(r, ',')));
+  CHECK(SUCCESS(read_int(r, &entry->frames)));
+  CHECK(SUCCESS(expect_char(r, ',')));
+  CHECK(SUCCESS(read_string(r, &entry->hash)));
+  CHECK(SUCCESS(expect_char(r, ']')));
+  return OK;
+error:
+  manifest_entry_delete(entry);
+  return ERROR;
+}
+
+static Result manifest_append(Manifest* manifest,
+                              const ManifestEntry* entry) {
+  if (manifest->count == manifest->capacity) {
+    size_t capacity = manifest->capacity ? manifest->capacity * 2 : 64;
+    ManifestEntry* entries =
+        xrealloc(manifest->entries, capacity * sizeof(ManifestEntry));
+    CHECK_MSG(entries != NULL, "Manifest allocation failed.\n");
+    manifest->entries = entries;
+    manifest->capacity = capacity;
+  }
+  manifest->entries[manifest->count++] = *entry;
+  return OK;
+  ON_ERROR_RETURN;
+}
+
+Result manifest_read(const char* filename, Manifest* out_manifest) {
+  FileData file_data;
+  ZERO_MEMORY(file_data);
+  CHECK(SUCCESS(file_read(filename, &file_data)));
+
+  ManifestReader r;
+  r.filename = filename;
+  r.p = (const char*)file_data.data;
+  r.end = r.p + file_data.size;
+  r.line = 1;
+
+  CHECK(SUCCESS(expect_char(&r, '[')));
+  if (!match_char(&r, ']')) {
+    do {
+      ManifestEntry entry;
+      CHECK(SUCCESS(read_entry(&r, &entry)));
+      if (!SUCCESS(manifest_append(out_manifest, &entry))) {
+        manifest_entry_delete(&entry);
+        goto error;
+      }
+    } while (match_char(&r, ','));
+    CHECK(SUCCESS(expect_char(&r, ']')));
+  }
+  file_data_delete(&file_data);
+  return OK;
+error:
+  file_data_delete(&file_data);
+  return ERROR;
+}
+
+void manifest_entry_delete(ManifestEntry* entry) {
+  xfree(entry->suite);
+  xfree(entry->rom);
+  xfree(entry->hash);
+  ZERO_MEMORY(*entry);
+}
+
+void manifest_delete(Manifest* manifest) {
+  size_t i;
+  for (i = 0; i < manifest->count; ++i) {
+    manifest_entry_delete(&manifest->entries[i]);
+  }
+  xfree(manifest->entries);
+  ZERO_MEMORY(*manifest);
+}
@@ -0,0 +1,37 @@
+#ifndef BINJGB_MANIFEST_H_
+#define BINJGB_MANIFEST_H_
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A test manifest, in the same format as scripts/test.json:
+ *
+ *   [ [suite, rom, frames, hash], ... ]
+ *
+ * The hash is the SHA-1 of the PPM file that binjgb-tester would write for
+ * the final frame. A hash prefixed with '!' is a known failure. */
+typedef struct {
+  char* suite;
+  char* rom;
+  int frames;
+  char* hash;
+} ManifestEntry;
+
+typedef struct {
+  ManifestEntry* entries;
+  size_t count;
+  size_t capacity;
+} Manifest;
+
+Result manifest_read(const char* filename, Manifest* out_manifest);
+void manifest_delete(Manifest*);
+void manifest_entry_delete(ManifestEntry*);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BINJGB_MANIFEST_H_ */
@@ -32,6 +32,13 @@ void* xcalloc_(const char* file, int line, size_t count, size_t size) {
   return p;
 }
 
+void* xrealloc_(const char* file, int line, void* p, size_t size) {
+  void* new_p = realloc(p, size);
+  printf("%s:%d: %s(%p, %" PRIu64 ") => %p\n", file, line, __func__, p,
+         (uint64_t)size, new_p);
+  return new_p;
+}
+
 char* xstrdup_(const char* file, int line, const char* s) {
   char* p = strdup(s);
   printf("%s:%d: %s(%p) => %p\n", file, line, __func__, s, p);
@@ -21,12 +21,14 @@ extern "C" {
 #define xmalloc(size) xmalloc_(__FILE__, __LINE__, size)
 #define xfree(p) xfree_(__FILE__, __LINE__, p)
 #define xcalloc(count, size) xcalloc_(__FILE__, __LINE__, count, size)
+#define xrealloc(p, size) xrealloc_(__FILE__, __LINE__, p, size)
 #define xstrdup(s) xstrdup_(__FILE__, __LINE__, s)
 
 /* Use these instead to make it easier to track memory usage. */
 void* xmalloc_(const char* file, int line, size_t);
 void xfree_(const char* file, int line, void*);
 void* xcalloc_(const char* file, int line, size_t, size_t);
+void* xrealloc_(const char* file, int line, void*, size_t);
 char* xstrdup_(const char* file, int line, const char*);
 
 #else
@@ -34,6 +36,7 @@ char* xstrdup_(const char* file, int line, const char*);
 #define xmalloc malloc
 #define xfree free
 #define xcalloc calloc
+#define xrealloc realloc
 #define xstrdup strdup
 
 #endif
@@ -11,10 +11,25 @@
 
 #include "emulator.h"
 
+/* After common.h: windows.h redefines TRUE and FALSE. */
+#ifdef _MSC_VER
+#define WIN32_LEAN_AND_MEAN
+#define NOGDI
+#include <windows.h>
+#undef ERROR
+#else
+#include <sys/time.h>
+#endif
+
 #define SANITY_CHECK 0
 
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xffff
+#define LZ_HASH_BITS 12
+
 #define GET_TICKS(x) ((x).ticks)
 #define CMP_GT(x, y) ((x) > (y))
+#define CMP_LT(x, y) ((x) < (y))
 
 #define CHECK_WRITE(count, dst, dst_max_end) \
   do {                                       \
@@ -98,6 +113,8 @@ RewindBuffer* rewind_new(const RewindInit* init, Emulator* e) {
   emulator_init_state_file_data(&buffer->last_base_state);
   emulator_init_state_file_data(&buffer->rewind_diff_state);
   buffer->last_base_state_ticks = INVALID_TICKS;
+  buffer->rewind_diff_state_ticks = INVALID_TICKS;
+  memset(&buffer->base_dirty_pages, 0xff, sizeof(buffer->base_dirty_pages));
   buffer->data_range[0].begin = buffer->data_range[0].end = data;
   buffer->data_range[1] = buffer->data_range[0];
   RewindInfo* info = (RewindInfo*)(data + capacity);
@@ -105,12 +122,16 @@ RewindBuffer* rewind_new(const RewindInit* init, Emulator* e) {
   buffer->info_range[1] = buffer->info_range[0];
   buffer->frames_until_next_base = 0;
 
+  /* rewind_append only copies the pages that changed since the emulator's
+   * last snapshot, so start from a full copy. */
+  (void)emulator_write_state(e, &buffer->last_state);
   rewind_append(buffer, e);
 
   return buffer;
 }
 
 void rewind_delete(RewindBuffer* buffer) {
+  xfree(buffer->keyframes.data);
   xfree(buffer->rewind_diff_state.data);
   xfree(buffer->last_base_state.data);
   xfree(buffer->last_state.data);
@@ -188,19 +209,408 @@ static void decode_diff(const u8* src, size_t src_size, const u8* base, u8* dst,
   assert(dst == dst_end);
 }
 
-static RewindInfo* find_first_base_in_range(RewindInfoRange range) {
-  RewindInfo* base = range.begin;
-  for (; base < range.end; base++) {
-    if (base->kind == RewindInfoKind_Base) {
-      return base;
+static u64 load_xor_u64(const u8* src, const u8* base, size_t word) {
+  u64 value;
+  memcpy(&value, src + word * 8, sizeof(value));
+  if (base) {
+    u64 base_value;
+    memcpy(&base_value, base + word * 8, sizeof(base_value));
+    value ^= base_value;
+  }
+  return value;
+}
+
+/* Encoded as alternating varint counts of zero words and nonzero words, each
+ * followed by that many literal words. Bytes past the last whole word are
+ * written as-is. */
+static u8* encode_zero_run(const u8* src, const u8* base, size_t src_size,
+                           u8* dst_begin, u8* dst_max_end) {
+  u8* dst = dst_begin;
+  size_t words = src_size / 8;
+  size_t i = 0;
+  while (i < words) {
+    size_t zero_begin = i;
+    while (i < words && load_xor_u64(src, base, i) == 0) {
+      i++;
+    }
+    size_t literal_begin = i;
+    while (i < words && load_xor_u64(src, base, i) != 0) {
+      i++;
+    }
+    dst = write_varint((u32)(literal_begin - zero_begin), dst, dst_max_end);
+    if (!dst) {
+      return NULL;
     }
+    dst = write_varint((u32)(i - literal_begin), dst, dst_max_end);
+    if (!dst) {
+      return NULL;
+    }
+    CHECK_WRITE((i - literal_begin) * 8, dst, dst_max_end);
+    size_t j;
+    for (j = literal_begin; j < i; ++j) {
+      u64 value = load_xor_u64(src, base, j);
+      memcpy(dst, &value, sizeof(value));
+      dst += sizeof(value);
+    }
+  }
+
+  size_t k;
+  CHECK_WRITE(src_size - words * 8, dst, dst_max_end);
+  for (k = words * 8; k < src_size; ++k) {
+    *dst++ = src[k] ^ (base ? base[k] : 0);
   }
-  return NULL;
+  return dst;
 }
 
-void rewind_append(RewindBuffer* buf, Emulator* e) {
-  Ticks ticks = emulator_get_ticks(e);
-  (void)emulator_write_state(e, &buf->last_state);
+static void decode_zero_run(const u8* src, size_t src_size, const u8* base,
+                            u8* dst, u8* dst_end) {
+  const u8* src_end = src + src_size;
+  size_t size = dst_end - dst;
+  size_t words = size / 8;
+  size_t i = 0;
+  while (i < words) {
+    u32 zero_count = read_varint(&src);
+    u32 literal_count = read_varint(&src);
+    assert(i + zero_count + literal_count <= words);
+    for (; zero_count > 0; zero_count--, i++) {
+      u64 value = base ? load_xor_u64(base, NULL, i) : 0;
+      memcpy(dst + i * 8, &value, sizeof(value));
+    }
+    for (; literal_count > 0; literal_count--, i++) {
+      u64 value = load_xor_u64(src, base ? base + i * 8 : NULL, 0);
+      memcpy(dst + i * 8, &value, sizeof(value));
+      src += sizeof(value);
+    }
+  }
+
+  size_t k;
+  for (k = words * 8; k < size; ++k) {
+    dst[k] = *src++ ^ (base ? base[k] : 0);
+  }
+  assert(src == src_end);
+}
+
+static u8 lz_read(const u8* src, const u8* base, size_t i) {
+  return src[i] ^ (base ? base[i] : 0);
+}
+
+static u32 lz_read_u32(const u8* src, const u8* base, size_t i) {
+  u32 value;
+  memcpy(&value, src + i, sizeof(value));
+  if (base) {
+    u32 base_value;
+    memcpy(&base_value, base + i, sizeof(base_value));
+    value ^= base_value;
+  }
+  return value;
+}
+
+static u8* lz_write_sequence(const u8* src, const u8* base, size_t literal_begin,
+                             size_t literal_count, size_t match_length,
+                             size_t offset, u8* dst, u8* dst_max_end) {
+  size_t match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+  CHECK_WRITE(1, dst, dst_max_end);
+  *dst++ = (u8)((MIN(literal_count, 15) << 4) | MIN(match_code, 15));
+  if (literal_count >= 15) {
+    dst = write_varint((u32)(literal_count - 15), dst, dst_max_end);
+    if (!dst) {
+      return NULL;
+    }
+  }
+  CHECK_WRITE(literal_count, dst, dst_max_end);
+  size_t i;
+  for (i = 0; i < literal_count; ++i) {
+    *dst++ = lz_read(src, base, literal_begin + i);
+  }
+  if (match_length) {
+    if (match_code >= 15) {
+      dst = write_varint((u32)(match_code - 15), dst, dst_max_end);
+      if (!dst) {
+        return NULL;
+      }
+    }
+    CHECK_WRITE(2, dst, dst_max_end);
+    *dst++ = (u8)offset;
+    *dst++ = (u8)(offset >> 8);
+  }
+  return dst;
+}
+
+/* LZ77, encoded as a sequence of tokens: the high nibble is the literal count
+ * and the low nibble is the match length minus LZ_MIN_MATCH, with 15 meaning
+ * a varint of the remainder follows. Each token is followed by its literals,
+ * then a u16 match offset. The final token has no match if it ends the
+ * data. */
+static u8* encode_lz(const u8* src, const u8* base, size_t src_size,
+                     u8* dst_begin, u8* dst_max_end) {
+  u32 table[1 << LZ_HASH_BITS]; /* Position + 1, or 0 if empty. */
+  memset(table, 0, sizeof(table));
+  u8* dst = dst_begin;
+  size_t anchor = 0;
+  size_t i = 0;
+  while (i + LZ_MIN_MATCH <= src_size) {
+    u32 seq = lz_read_u32(src, base, i);
+    u32 hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+    size_t candidate = table[hash];
+    table[hash] = (u32)(i + 1);
+    if (candidate == 0 || i - (candidate - 1) > LZ_MAX_OFFSET ||
+        lz_read_u32(src, base, candidate - 1) != seq) {
+      i++;
+      continue;
+    }
+
+    size_t match = candidate - 1;
+    size_t length = LZ_MIN_MATCH;
+    while (i + length < src_size &&
+           lz_read(src, base, i + length) == lz_read(src, base, match + length)) {
+      length++;
+    }
+    dst = lz_write_sequence(src, base, anchor, i - anchor, length, i - match,
+                            dst, dst_max_end);
+    if (!dst) {
+      return NULL;
+    }
+    i += length;
+    anchor = i;
+  }
+
+  if (anchor < src_size) {
+    dst = lz_write_sequence(src, base, anchor, src_size - anchor, 0, 0, dst,
+                            dst_max_end);
+  }
+  return dst;
+}
+
+static void decode_lz(const u8* src, size_t src_size, const u8* base, u8* dst,
+                      u8* dst_end) {
+  const u8* src_end = src + src_size;
+  u8* dst_begin = dst;
+  while (dst < dst_end) {
+    u8 token = *src++;
+    size_t literal_count = token >> 4;
+    if (literal_count == 15) {
+      literal_count += read_varint(&src);
+    }
+    assert(dst + literal_count <= dst_end);
+    memcpy(dst, src, literal_count);
+    dst += literal_count;
+    src += literal_count;
+    if (dst == dst_end) {
+      break;
+    }
+
+    size_t length = (token & 15) + LZ_MIN_MATCH;
+    if ((token & 15) == 15) {
+      length += read_varint(&src);
+    }
+    size_t offset = src[0] | (src[1] << 8);
+    src += 2;
+    assert(offset > 0 && dst - offset >= dst_begin);
+    assert(dst + length <= dst_end);
+    /* Matches may overlap the bytes they produce, so copy a byte at a time. */
+    const u8* match = dst - offset;
+    for (; length > 0; length--) {
+      *dst++ = *match++;
+    }
+  }
+  assert(src == src_end);
+
+  if (base) {
+    for (dst = dst_begin; dst < dst_end; ++dst) {
+      *dst ^= *base++;
+    }
+  }
+}
+
+static u8* encode_rle_codec(const u8* src, const u8* base, size_t src_size,
+                            u8* dst_begin, u8* dst_max_end) {
+  return base ? encode_diff(src, base, src_size, dst_begin, dst_max_end)
+              : encode_rle(src, src_size, dst_begin, dst_max_end);
+}
+
+static void decode_rle_codec(const u8* src, size_t src_size, const u8* base,
+                             u8* dst, u8* dst_end) {
+  if (base) {
+    decode_diff(src, src_size, base, dst, dst_end);
+  } else {
+    decode_rle(src, src_size, dst, dst_end);
+  }
+}
+
+/* A codec encodes |src|, or its difference from |base| if |base| is non-NULL.
+ * encode returns the new end of the destination, or NULL if it didn't fit. */
+typedef struct {
+  const char* name;
+  u8* (*encode)(const u8* src, const u8* base, size_t src_size, u8* dst_begin,
+                u8* dst_max_end);
+  void (*decode)(const u8* src, size_t src_size, const u8* base, u8* dst,
+                 u8* dst_end);
+} RewindCodecInfo;
+
+static const RewindCodecInfo s_rewind_codecs[] = {
+  [RewindCodec_Rle] = {"rle", encode_rle_codec, decode_rle_codec},
+  [RewindCodec_ZeroRun] = {"zero-run", encode_zero_run, decode_zero_run},
+  [RewindCodec_Lz] = {"lz", encode_lz, decode_lz},
+};
+
+static const RewindCodecInfo* get_codec(RewindBuffer* buf) {
+  assert(buf->init.codec < RewindCodec_Count);
+  return &s_rewind_codecs[buf->init.codec];
+}
+
+static f64 get_time_sec(void) {
+#ifdef _MSC_VER
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (f64)counter.QuadPart / (f64)frequency.QuadPart;
+#else
+  struct timeval tp;
+  gettimeofday(&tp, NULL);
+  return (f64)tp.tv_sec + (f64)tp.tv_usec / 1000000.0;
+#endif
+}
+
+/* Finds the next run of pages in |pages|, starting at |*page|, and returns its
+ * byte range in a state of |size| bytes. */
+static Bool next_page_run(const EmulatorStatePages* pages, size_t size,
+                          size_t* page, size_t* out_begin, size_t* out_end) {
+  size_t page_count =
+      (size + EMULATOR_STATE_PAGE_SIZE - 1) / EMULATOR_STATE_PAGE_SIZE;
+  size_t p = *page;
+  while (p < page_count && !EMULATOR_STATE_PAGES_HAS(*pages, p)) {
+    p++;
+  }
+  if (p == page_count) {
+    *page = p;
+    return FALSE;
+  }
+  *out_begin = p * EMULATOR_STATE_PAGE_SIZE;
+  while (p < page_count && EMULATOR_STATE_PAGES_HAS(*pages, p)) {
+    p++;
+  }
+  *out_end = MIN(p * EMULATOR_STATE_PAGE_SIZE, size);
+  *page = p;
+  return TRUE;
+}
+
+/* Pages that weren't written since the base state are identical to it, so
+ * only the written ones are diffed. The encoding is the page set, followed by
+ * each run of written pages as a u32 size and its encoded diff. */
+static u8* encode_diff_pages(const RewindCodecInfo* codec, const u8* src,
+                             const u8* base, size_t src_size,
+                             const EmulatorStatePages* pages, u8* dst_begin,
+                             u8* dst_max_end) {
+  u8* dst = dst_begin;
+  CHECK_WRITE(sizeof(*pages), dst, dst_max_end);
+  memcpy(dst, pages, sizeof(*pages));
+  dst += sizeof(*pages);
+
+  size_t page = 0, begin, end;
+  while (next_page_run(pages, src_size, &page, &begin, &end)) {
+    CHECK_WRITE(sizeof(u32), dst, dst_max_end);
+    u8* run_begin = dst + sizeof(u32);
+    u8* run_end = codec->encode(src + begin, base + begin, end - begin,
+                                run_begin, dst_max_end);
+    if (!run_end) {
+      return NULL;
+    }
+    u32 run_size = (u32)(run_end - run_begin);
+    memcpy(dst, &run_size, sizeof(run_size));
+    dst = run_end;
+  }
+  return dst;
+}
+
+static void decode_diff_pages(const RewindCodecInfo* codec, const u8* src,
+                              size_t src_size, const u8* base, u8* dst,
+                              u8* dst_end) {
+  const u8* src_end = src + src_size;
+  size_t size = dst_end - dst;
+  EmulatorStatePages pages;
+  memcpy(&pages, src, sizeof(pages));
+  src += sizeof(pages);
+  memcpy(dst, base, size);
+
+  size_t page = 0, begin, end;
+  while (next_page_run(&pages, size, &page, &begin, &end)) {
+    u32 run_size;
+    memcpy(&run_size, src, sizeof(run_size));
+    src += sizeof(run_size);
+    codec->decode(src, run_size, base + begin, dst + begin, dst + end);
+    src += run_size;
+  }
+  assert(src == src_end);
+}
+
+static void push_keyframe(RewindBuffer* buf, Ticks ticks, RewindInfo* info) {
+  RewindKeyframeIndex* index = &buf->keyframes;
+  assert(index->begin == index->end ||
+         index->data[index->end - 1].ticks < ticks);
+  if (index->end == index->capacity) {
+    size_t count = index->end - index->begin;
+    if (index->begin > 0) {
+      memmove(index->data, index->data + index->begin,
+              count * sizeof(RewindKeyframe));
+    } else {
+      size_t new_capacity = index->capacity ? index->capacity * 2 : 64;
+      RewindKeyframe* new_data = xmalloc(new_capacity * sizeof(RewindKeyframe));
+      if (count) {
+        memcpy(new_data, index->data, count * sizeof(RewindKeyframe));
+      }
+      xfree(index->data);
+      index->data = new_data;
+      index->capacity = new_capacity;
+    }
+    index->begin = 0;
+    index->end = count;
+  }
+  index->data[index->end].ticks = ticks;
+  index->data[index->end].info = info;
+  index->end++;
+}
+
+static Bool is_info_in_range(RewindInfo* info, RewindInfoRange* range) {
+  return info >= range->begin && info < range->end;
+}
+
+/* RewindInfo slots are reused once the data they describe is overwritten, so
+ * a keyframe is only valid while its slot is still in use for that base. */
+static Bool is_keyframe_valid(RewindBuffer* buf, RewindKeyframe* keyframe) {
+  RewindInfo* info = keyframe->info;
+  return (is_info_in_range(info, &buf->info_range[0]) ||
+          is_info_in_range(info, &buf->info_range[1])) &&
+         info->ticks == keyframe->ticks && info->kind == RewindInfoKind_Base;
+}
+
+/* Returns the newest base state at or before |ticks|, or NULL. */
+static RewindInfo* find_keyframe(RewindBuffer* buf, Ticks ticks) {
+  RewindKeyframeIndex* index = &buf->keyframes;
+  RewindKeyframe* begin = index->data + index->begin;
+  RewindKeyframe* end = index->data + index->end;
+  LOWER_BOUND(RewindKeyframe, found, begin, end, ticks, GET_TICKS, CMP_LT);
+  if (!found || found->ticks > ticks) {
+    return NULL;
+  }
+  assert(is_keyframe_valid(buf, found));
+  return found->info;
+}
+
+static void copy_state_pages(FileData* dst, const u8* src,
+                             const EmulatorStatePages* pages) {
+  size_t page = 0, begin, end;
+  while (next_page_run(pages, dst->size, &page, &begin, &end)) {
+    memcpy(dst->data + begin, src + begin, end - begin);
+  }
+}
+
+/* Encode last_state, which was just updated with the |written| pages. */
+static void append_last_state(RewindBuffer* buf, Ticks ticks,
+                              const EmulatorStatePages* written) {
+  size_t i;
+  for (i = 0; i < ARRAY_SIZE(written->bits); ++i) {
+    buf->base_dirty_pages.bits[i] |= written->bits[i];
+  }
 
   /* The new state must be written in sorted order; if it is out of order (from
    * a rewind), then the subsequent saved states should have been cleared
@@ -216,6 +626,8 @@ void rewind_append(RewindBuffer* buf, Emulator* e) {
     kind = RewindInfoKind_Diff;
   }
 
+  const RewindCodecInfo* codec = get_codec(buf);
+  f64 encode_start_sec = get_time_sec();
   u8* data_begin = NULL;
   u8* data_end_max = NULL;
   u8* data_end = NULL;
@@ -241,9 +653,10 @@ void rewind_append(RewindBuffer* buf, Emulator* e) {
     switch (kind) {
       case RewindInfoKind_Diff:
         if (buf->last_base_state_ticks != INVALID_TICKS) {
-          data_end =
-              encode_diff(buf->last_state.data, buf->last_base_state.data,
-                          buf->last_state.size, data_begin, data_end_max);
+          data_end = encode_diff_pages(
+              codec, buf->last_state.data, buf->last_base_state.data,
+              buf->last_state.size, &buf->base_dirty_pages, data_begin,
+              data_end_max);
           break;
         }
         /* There is no previous base state, so we can't diff. Fallthrough to
@@ -251,11 +664,9 @@ void rewind_append(RewindBuffer* buf, Emulator* e) {
 
       case RewindInfoKind_Base:
         kind = RewindInfoKind_Base;
-        data_end = encode_rle(buf->last_state.data, buf->last_state.size,
-                              data_begin, data_end_max);
-        memcpy(buf->last_base_state.data, buf->last_state.data,
-               buf->last_state.size);
-        buf->last_base_state_ticks = ticks;
+        data_end = codec->encode(buf->last_state.data, NULL,
+                                 buf->last_state.size, data_begin,
+                                 data_end_max);
         break;
     }
 
@@ -269,6 +680,16 @@ void rewind_append(RewindBuffer* buf, Emulator* e) {
 
   assert(data_end <= data_end_max);
   data_range[0].end = data_end;
+  buf->total_encode_sec += get_time_sec() - encode_start_sec;
+  buf->encode_count++;
+
+  if (kind == RewindInfoKind_Base) {
+    push_keyframe(buf, ticks, new_info);
+    copy_state_pages(&buf->last_base_state, buf->last_state.data,
+                     &buf->base_dirty_pages);
+    ZERO_MEMORY(buf->base_dirty_pages);
+    buf->last_base_state_ticks = ticks;
+  }
 
   /* Check to see how many data chunks we overwrote. */
   RewindInfo* new_end = info_range[1].end;
@@ -294,13 +715,48 @@ void rewind_append(RewindBuffer* buf, Emulator* e) {
         info_range[0].begin->data + info_range[0].begin->size;
   }
 
+  /* Drop the keyframes for base states that were just overwritten. */
+  RewindKeyframeIndex* index = &buf->keyframes;
+  while (index->begin < index->end &&
+         !is_keyframe_valid(buf, &index->data[index->begin])) {
+    index->begin++;
+  }
+
   /* Update stats. */
   buf->total_kind_bytes[kind] += new_info->size;
   buf->total_uncompressed_bytes += buf->last_state.size;
+}
 
+void rewind_append(RewindBuffer* buf, Emulator* e) {
+  EmulatorStatePages written;
+  (void)emulator_write_state_snapshot(e, &buf->last_state, &written);
+  append_last_state(buf, emulator_get_ticks(e), &written);
   rewind_sanity_check(buf, e);
 }
 
+void rewind_capture_init(RewindCapture* capture) {
+  ZERO_MEMORY(*capture);
+  capture->ticks = INVALID_TICKS;
+  emulator_init_state_file_data(&capture->state);
+}
+
+void rewind_capture_delete(RewindCapture* capture) {
+  xfree(capture->state.data);
+}
+
+void rewind_capture(RewindCapture* capture, Emulator* e) {
+  /* Only the pages that changed since the previous snapshot are written; the
+   * rest of |capture->state| is stale, which is fine since
+   * rewind_append_capture only reads the written pages. */
+  (void)emulator_write_state_snapshot(e, &capture->state, &capture->written);
+  capture->ticks = emulator_get_ticks(e);
+}
+
+void rewind_append_capture(RewindBuffer* buf, const RewindCapture* capture) {
+  copy_state_pages(&buf->last_state, capture->state.data, &capture->written);
+  append_last_state(buf, capture->ticks, &capture->written);
+}
+
 Result rewind_to_ticks(RewindBuffer* buf, Ticks ticks,
                         RewindResult* out_result) {
   RewindInfoRange* info_range = buf->info_range;
@@ -333,39 +789,34 @@ Result rewind_to_ticks(RewindBuffer* buf, Ticks ticks,
 
   assert(found->ticks <= ticks);
 
-  FileData* file_data = NULL;
-  if (found->kind == RewindInfoKind_Base) {
-    file_data = &buf->last_base_state;
-    decode_rle(found->data, found->size, file_data->data,
-               file_data->data + file_data->size);
-    buf->last_base_state_ticks = found->ticks;
-  } else {
-    assert(found->kind == RewindInfoKind_Diff);
-    /* Find the previous base state. */
-    RewindInfoRange range = {found, end};
-    RewindInfo* base_info = find_first_base_in_range(range);
-    if (!base_info) {
-      if (info_range_index == 1) {
-        /* No previous base state, can't decode. */
-        return ERROR;
-      }
-
-      /* Search the previous range. */
-      base_info = find_first_base_in_range(info_range[1]);
-      if (!base_info) {
-        return ERROR;
-      }
-    }
+  const RewindCodecInfo* codec = get_codec(buf);
+  f64 decode_start_sec = get_time_sec();
+  /* Find the base state; the state itself if it is one. */
+  RewindInfo* base_info = find_keyframe(buf, found->ticks);
+  if (!base_info) {
+    return ERROR;
+  }
+  assert(found->kind == RewindInfoKind_Diff || base_info == found);
 
-    FileData* base = &buf->last_base_state;
-    decode_rle(base_info->data, base_info->size, base->data,
-               base->data + base->size);
+  FileData* base = &buf->last_base_state;
+  if (base_info->ticks != buf->last_base_state_ticks) {
+    codec->decode(base_info->data, base_info->size, NULL, base->data,
+                  base->data + base->size);
     buf->last_base_state_ticks = base_info->ticks;
+    memset(&buf->base_dirty_pages, 0xff, sizeof(buf->base_dirty_pages));
+  }
 
+  FileData* file_data = base;
+  if (found->kind == RewindInfoKind_Diff) {
     file_data = &buf->rewind_diff_state;
-    decode_diff(found->data, found->size, base->data, file_data->data,
-                file_data->data + file_data->size);
+    if (found->ticks != buf->rewind_diff_state_ticks) {
+      decode_diff_pages(codec, found->data, found->size, base->data,
+                        file_data->data, file_data->data + file_data->size);
+      buf->rewind_diff_state_ticks = found->ticks;
+    }
   }
+  buf->total_decode_sec += get_time_sec() - decode_start_sec;
+  buf->decode_count++;
 
   out_result->info_range_index = info_range_index;
   out_result->info = found;
@@ -387,6 +838,16 @@ void rewind_truncate_to(RewindBuffer* buffer, Emulator* e,
     data_range[0].end = data_range[0].begin;
   }
 
+  RewindKeyframeIndex* index = &buffer->keyframes;
+  while (index->begin < index->end &&
+         index->data[index->end - 1].ticks > info->ticks) {
+    index->end--;
+  }
+
+  /* States newer than |info| may be appended again with different contents,
+   * so the decoded diff can't be reused. */
+  buffer->rewind_diff_state_ticks = INVALID_TICKS;
+
   rewind_sanity_check(buffer, e);
 }
 
@@ -430,6 +891,11 @@ RewindStats rewind_get_stats(RewindBuffer* buffer) {
   stats.uncompressed_bytes = buffer->total_uncompressed_bytes;
   stats.used_bytes = 0;
   stats.capacity_bytes = buffer->init.buffer_capacity;
+  stats.codec_name = get_codec(buffer)->name;
+  stats.total_encode_sec = buffer->total_encode_sec;
+  stats.total_decode_sec = buffer->total_decode_sec;
+  stats.encode_count = buffer->encode_count;
+  stats.decode_count = buffer->decode_count;
 
   u8* begin = buffer->data_range[0].begin;
   int i;
@@ -499,13 +965,14 @@ void rewind_sanity_check(RewindBuffer* buffer, Emulator* e) {
       FileData* fd = NULL;
       if (info->kind == RewindInfoKind_Base) {
         has_base = TRUE;
-        decode_rle(info->data, info->size, base.data, base.data + base.size);
+        get_codec(buffer)->decode(info->data, info->size, NULL, base.data,
+                                  base.data + base.size);
         fd = &base;
       } else {
         assert(info->kind == RewindInfoKind_Diff);
         if (has_base) {
-          decode_diff(info->data, info->size, base.data, diff.data,
-                      diff.data + diff.size);
+          decode_diff_pages(get_codec(buffer), info->data, info->size,
+                            base.data, diff.data, diff.data + diff.size);
           fd = &diff;
         }
       }
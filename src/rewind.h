@@ -8,6 +8,7 @@
 #define BINJGB_REWIND_H_
 
 #include "common.h"
+#include "emulator.h"
 
 struct Emulator;
 
@@ -27,6 +28,13 @@ typedef struct {
   RewindInfoKind kind;
 } RewindInfo;
 
+typedef enum {
+  RewindCodec_Rle,     /* Byte RLE of the state, or of its difference. */
+  RewindCodec_ZeroRun, /* Zero/literal u64 word runs of the XOR diff. */
+  RewindCodec_Lz,      /* LZ77 of the state, or of its XOR diff. */
+  RewindCodec_Count,
+} RewindCodec;
+
 typedef struct {
   RewindInfo* begin; /* begin <= end; if begin == end range is empty. */
   RewindInfo* end;   /* end is exclusive. */
@@ -37,6 +45,20 @@ typedef struct {
   u8* end;
 } RewindDataRange;
 
+typedef struct {
+  Ticks ticks;
+  RewindInfo* info;
+} RewindKeyframe;
+
+/* The base states in both info ranges, oldest first. Entries are only added
+ * at the end (by rewind_append) and removed from either end (when
+ * rewind_append overwrites old data, or by rewind_truncate_to), so it stays
+ * sorted by ticks. */
+typedef struct {
+  RewindKeyframe* data;
+  size_t begin, end, capacity;
+} RewindKeyframeIndex;
+
 typedef struct {
   int info_range_index;
   RewindInfo* info;
@@ -46,6 +68,7 @@ typedef struct {
 typedef struct {
   size_t buffer_capacity;
   int frames_per_base_state;
+  RewindCodec codec;
 } RewindInit;
 
 typedef struct RewindBuffer {
@@ -79,16 +102,36 @@ typedef struct RewindBuffer {
   FileData last_state;
   FileData last_base_state;
   Ticks last_base_state_ticks;
+  /* Pages of last_state that may differ from last_base_state. */
+  EmulatorStatePages base_dirty_pages;
   int frames_until_next_base;
 
-  /* Data is decompressed into these states when rewinding. */
+  /* Data is decompressed into these states when rewinding. last_base_state
+   * always holds the base state at last_base_state_ticks, so it is only
+   * decoded when a different base is needed. */
   FileData rewind_diff_state;
+  Ticks rewind_diff_state_ticks;
+
+  RewindKeyframeIndex keyframes;
 
   /* Stats */
   size_t total_kind_bytes[2];
   size_t total_uncompressed_bytes;
+  f64 total_encode_sec;
+  f64 total_decode_sec;
+  size_t encode_count;
+  size_t decode_count;
 } RewindBuffer;
 
+/* A state captured by rewind_capture, to be encoded later (possibly on
+ * another thread) by rewind_append_capture. Only the pages in |written| are
+ * valid, so captures must be appended in the order they were taken. */
+typedef struct {
+  Ticks ticks;
+  FileData state;
+  EmulatorStatePages written;
+} RewindCapture;
+
 typedef struct {
   size_t base_bytes;
   size_t diff_bytes;
@@ -98,11 +141,21 @@ typedef struct {
 
   size_t data_ranges[4];
   size_t info_ranges[4];
+
+  const char* codec_name;
+  f64 total_encode_sec; /* Time spent in rewind_append encoding states. */
+  f64 total_decode_sec; /* Time spent in rewind_to_ticks decoding states. */
+  size_t encode_count;
+  size_t decode_count;
 } RewindStats;
 
 RewindBuffer* rewind_new(const RewindInit*, struct Emulator*);
 void rewind_delete(RewindBuffer*);
 void rewind_append(RewindBuffer*, struct Emulator*);
+void rewind_capture_init(RewindCapture*);
+void rewind_capture_delete(RewindCapture*);
+void rewind_capture(RewindCapture*, struct Emulator*);
+void rewind_append_capture(RewindBuffer*, const RewindCapture*);
 Result rewind_to_ticks(RewindBuffer*, Ticks, RewindResult*);
 void rewind_truncate_to(RewindBuffer*, struct Emulator*, RewindResult*);
 Ticks rewind_get_oldest_ticks(RewindBuffer*);
@@ -32,6 +32,7 @@
 static const char* s_joypad_filename;
 static int s_frames = DEFAULT_FRAMES;
 static const char* s_output_ppm;
+static const char* s_apu_log_filename;
 static Bool s_animate;
 static Bool s_print_ops;
 static u32 s_print_ops_limit = MAX_PRINT_OPS_LIMIT;
@@ -42,6 +43,9 @@ static u32 s_random_seed = 0xcabba6e5;
 static u32 s_builtin_palette;
 static Bool s_force_dmg;
 static Bool s_use_sgb_border;
+#ifdef TESTER_DEBUGGER
+static EmulatorDebug* s_debug;
+#endif
 
 
 Result write_frame_ppm(Emulator* e, const char* filename) {
@@ -103,6 +107,7 @@ void usage(int argc, char** argv) {
       "  -f,--frames N        run for N frames (default: %u)\n"
       "  -o,--output FILE     output PPM file to FILE\n"
       "  -a,--animate         output an image every frame\n"
+      "     --apu-log FILE    write APU register writes to FILE\n"
 #ifdef TESTER_DEBUGGER
       "     --print-ops       print execution count of each opcode\n"
       "     --print-ops-limit max opcodes to print\n"
@@ -143,6 +148,7 @@ void parse_options(int argc, char**argv) {
     {'f', "frames", 1},
     {'o', "output", 1},
     {'a', "animate", 0},
+    {0, "apu-log", 1},
 #ifdef TESTER_DEBUGGER
     {0, "print-ops-limit", 1},
     {0, "print-ops", 0},
@@ -184,11 +190,12 @@ void parse_options(int argc, char**argv) {
 
 #ifdef TESTER_DEBUGGER
           case 't':
-            emulator_set_trace(TRUE);
+            emulator_set_trace(s_debug, TRUE);
             break;
 
           case 'l':
-            switch (emulator_set_log_level_from_string(result.value)) {
+            switch (emulator_set_log_level_from_string(s_debug,
+                                                       result.value)) {
               case SET_LOG_LEVEL_ERROR_NONE:
                 break;
 
@@ -235,7 +242,7 @@ void parse_options(int argc, char**argv) {
 #ifdef TESTER_DEBUGGER
             if (strcmp(result.option->long_name, "print-ops") == 0) {
               s_print_ops = TRUE;
-              emulator_set_opcode_count_enabled(TRUE);
+              emulator_set_opcode_count_enabled(s_debug, TRUE);
             } else if (strcmp(result.option->long_name, "print-ops-limit") ==
                        0) {
               s_print_ops_limit = atoi(result.value);
@@ -244,7 +251,7 @@ void parse_options(int argc, char**argv) {
               }
             } else if (strcmp(result.option->long_name, "profile") == 0) {
               s_profile = TRUE;
-              emulator_set_profiling_enabled(TRUE);
+              emulator_set_profiling_enabled(s_debug, TRUE);
             } else if (strcmp(result.option->long_name, "profile-limit") == 0) {
               s_profile_limit = atoi(result.value);
               if (s_profile_limit >= MAX_PROFILE_LIMIT) {
@@ -253,6 +260,8 @@ void parse_options(int argc, char**argv) {
 #else
             if (FALSE) {
 #endif
+            } else if (strcmp(result.option->long_name, "apu-log") == 0) {
+              s_apu_log_filename = result.value;
             } else if (strcmp(result.option->long_name, "force-dmg") == 0) {
               s_force_dmg = TRUE;
             } else if (strcmp(result.option->long_name, "sgb-border") == 0) {
@@ -305,8 +314,8 @@ int compare_pair(const void* a, const void* b) {
 }
 
 void print_ops(void) {
-  u32* opcode_count = emulator_get_opcode_count();
-  u32* cb_opcode_count = emulator_get_cb_opcode_count();
+  u32* opcode_count = emulator_get_opcode_count(s_debug);
+  u32* cb_opcode_count = emulator_get_cb_opcode_count(s_debug);
 
   U32Pair pairs[512];
   ZERO_MEMORY(pairs);
@@ -397,7 +406,7 @@ void extract_min_heap(U32Pair* min_heap, u32 last_index) {
 
 void print_profile(Emulator* e) {
   u32 rom_size = emulator_get_rom_size(e);
-  u32* counters = emulator_get_profiling_counters();
+  u32* counters = emulator_get_profiling_counters(s_debug);
   const u32 heap_limit = s_profile_limit;
   U32Pair* min_heap = xcalloc(heap_limit + 1, sizeof(U32Pair));
 
@@ -432,10 +441,13 @@ int main(int argc, char** argv) {
   Emulator* e = NULL;
   JoypadBuffer* joypad_buffer = NULL;
 
+#ifdef TESTER_DEBUGGER
+  s_debug = emulator_debug_new();
+#endif
   parse_options(argc, argv);
 
   FileData rom;
-  CHECK(SUCCESS(file_read_aligned(s_rom_filename, MINIMUM_ROM_SIZE, &rom)));
+  CHECK(SUCCESS(file_map_aligned(s_rom_filename, MINIMUM_ROM_SIZE, &rom)));
 
   EmulatorInit emulator_init;
   ZERO_MEMORY(emulator_init);
@@ -445,9 +457,18 @@ int main(int argc, char** argv) {
   emulator_init.random_seed = s_random_seed;
   emulator_init.builtin_palette = s_builtin_palette;
   emulator_init.force_dmg = s_force_dmg;
+#ifdef TESTER_DEBUGGER
+  emulator_init.debug = s_debug;
+#endif
   e = emulator_new(&emulator_init);
   CHECK(e != NULL);
 
+  /* Only the frame buffer is checked, so don't bother generating audio. */
+  EmulatorConfig emulator_config = emulator_get_config(e);
+  emulator_config.disable_audio = TRUE;
+  emulator_config.log_apu_writes = s_apu_log_filename != NULL;
+  emulator_set_config(e, &emulator_config);
+
   JoypadPlayback joypad_playback;
   if (s_joypad_filename) {
     FileData file_data;
@@ -459,7 +480,7 @@ int main(int argc, char** argv) {
 
 #ifdef TESTER_DEBUGGER
   /* Disable rom usage collecting since it's slow and not useful here. */
-  emulator_set_rom_usage_enabled(FALSE);
+  emulator_set_rom_usage_enabled(s_debug, FALSE);
 #endif
 
   u32 total_ticks = (u32)(s_frames * PPU_FRAME_TICKS);
@@ -469,9 +490,26 @@ int main(int argc, char** argv) {
   u32 animation_frame = 0; /* Will likely differ from PPU frame. */
   u32 next_input_frame = 0;
   u32 next_input_frame_buttons = 0;
+
+  /* Only the last frame is written, so don't render the frames before it. If
+   * the ROM stops early, the frame on screen may not have been rendered, so
+   * run again from the start with rendering. (Not done when logging APU
+   * writes or counting opcodes, since they'd be counted twice.) */
+  Bool skip_render = !s_animate && !s_apu_log_filename && !s_print_ops &&
+                     !s_profile && total_ticks > PPU_FRAME_TICKS;
+  FileData initial_state;
+  ZERO_MEMORY(initial_state);
+  if (skip_render) {
+    emulator_init_state_file_data(&initial_state);
+    CHECK(SUCCESS(emulator_write_state(e, &initial_state)));
+    emulator_config.skip_render = TRUE;
+    emulator_set_config(e, &emulator_config);
+  }
+
   f64 start_time = get_time_sec();
   while (TRUE) {
-    EmulatorEvent event = emulator_run_until(e, until_ticks);
+    EmulatorEvent event = emulator_run_until(
+        e, skip_render ? until_ticks - PPU_FRAME_TICKS : until_ticks);
     if (event & EMULATOR_EVENT_NEW_FRAME) {
       if (s_output_ppm && s_animate) {
         char buffer[32];
@@ -486,19 +524,37 @@ int main(int argc, char** argv) {
       }
     }
     if (event & EMULATOR_EVENT_UNTIL_TICKS) {
-      finish_at_next_frame = TRUE;
-      until_ticks += PPU_FRAME_TICKS;
+      if (skip_render) {
+        skip_render = FALSE;
+      } else {
+        finish_at_next_frame = TRUE;
+        until_ticks += PPU_FRAME_TICKS;
+      }
     }
     if (event & EMULATOR_EVENT_INVALID_OPCODE) {
-      printf("!! hit invalid opcode, pc=");
+      if (skip_render) {
+        CHECK(SUCCESS(emulator_read_state(e, &initial_state)));
+        if (s_joypad_filename) {
+          emulator_set_joypad_playback_callback(e, joypad_buffer,
+                                                &joypad_playback);
+        }
+        skip_render = FALSE;
+      } else {
+        printf("!! hit invalid opcode, pc=");
 #ifdef TESTER_DEBUGGER
-      printf("%04x\n", emulator_get_registers(e).PC);
+        printf("%04x\n", emulator_get_registers(e).PC);
 #else
-      printf("???\n");
+        printf("???\n");
 #endif
-      break;
+        break;
+      }
+    }
+    if (!skip_render && emulator_config.skip_render) {
+      emulator_config.skip_render = FALSE;
+      emulator_set_config(e, &emulator_config);
     }
   }
+  file_data_delete(&initial_state);
   f64 host_time = get_time_sec() - start_time;
   Ticks real_total_ticks = emulator_get_ticks(e);
   f64 gb_time = (f64)real_total_ticks / CPU_TICKS_PER_SECOND;
@@ -509,6 +565,10 @@ int main(int argc, char** argv) {
     CHECK(SUCCESS(write_frame_ppm(e, s_output_ppm)));
   }
 
+  if (s_apu_log_filename) {
+    CHECK(SUCCESS(emulator_write_apu_log_to_file(e, s_apu_log_filename)));
+  }
+
 #ifdef TESTER_DEBUGGER
   if (s_print_ops) {
     print_ops();
@@ -527,5 +587,8 @@ error:
   if (e) {
     emulator_delete(e);
   }
+#ifdef TESTER_DEBUGGER
+  emulator_debug_delete(s_debug);
+#endif
   return result;
 }
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emulator.h"
+#include "options.h"
+#include "tile-decode.h"
+
+/* After common.h: windows.h redefines TRUE and FALSE. */
+#ifdef _MSC_VER
+#define WIN32_LEAN_AND_MEAN
+#define NOGDI
+#include <windows.h>
+#undef ERROR
+#else
+#include <sys/time.h>
+#endif
+
+/* Compares tile_row_decode/tile_row_to_rgba against the bit-at-a-time loop
+ * the PPU used before, by expanding every tile row of a synthetic VRAM image
+ * into a frame buffer. The "bg" pass reads bit 7 first, like an unflipped
+ * BG tile. The "obj" pass x-flips a random half of the map entries, like
+ * objects: the old path shifts the bits out from bit 0, reversing them first
+ * if the object isn't flipped, where the decoder is passed the flip. Both
+ * implementations must produce the same pixels. */
+
+#define TILE_COUNT 384
+#define TILE_HEIGHT 8
+#define TILE_ROW_BYTES 2
+#define MAP_SIZE 32
+
+static int s_frames = 2000;
+static u32 s_random_seed = 0x5eed;
+
+static u8 s_tile_data[TILE_COUNT * TILE_HEIGHT * TILE_ROW_BYTES];
+static u16 s_map[MAP_SIZE * MAP_SIZE];
+static Bool s_xflip[MAP_SIZE * MAP_SIZE];
+static PaletteRGBA s_pal = {{MAKE_RGBA(255, 255, 255, 255),
+                             MAKE_RGBA(170, 170, 170, 255),
+                             MAKE_RGBA(85, 85, 85, 255),
+                             MAKE_RGBA(0, 0, 0, 255)}};
+static RGBA s_frame_buffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+
+static f64 get_time_sec(void) {
+#ifdef _MSC_VER
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (f64)counter.QuadPart / (f64)frequency.QuadPart;
+#else
+  struct timeval tp;
+  gettimeofday(&tp, NULL);
+  return (f64)tp.tv_sec + (f64)tp.tv_usec / 1000000.0;
+#endif
+}
+
+static u32 random_next(u32* state) {
+  *state = *state * 1103515245 + 12345;
+  return *state >> 16;
+}
+
+static u8 reverse_bits_u8(u8 x) {
+  x = ((x >> 1) & 0x55) | ((x << 1) & 0xaa);
+  x = ((x >> 2) & 0x33) | ((x << 2) & 0xcc);
+  return (x >> 4) | (x << 4);
+}
+
+static void render_bg_row_scalar(u8 lo, u8 hi, Bool xflip, RGBA* out) {
+  int i;
+  for (i = 0; i < TILE_ROW_PIXELS; ++i, lo <<= 1, hi <<= 1) {
+    out[i] = s_pal.color[((hi >> 6) & 2) | (lo >> 7)];
+  }
+}
+
+static void render_obj_row_scalar(u8 lo, u8 hi, Bool xflip, RGBA* out) {
+  int i;
+  if (!xflip) {
+    lo = reverse_bits_u8(lo);
+    hi = reverse_bits_u8(hi);
+  }
+  for (i = 0; i < TILE_ROW_PIXELS; ++i, lo >>= 1, hi >>= 1) {
+    out[i] = s_pal.color[((hi & 1) << 1) | (lo & 1)];
+  }
+}
+
+static void render_bg_row_decoder(u8 lo, u8 hi, Bool xflip, RGBA* out) {
+  u8 row[TILE_ROW_PIXELS];
+  tile_row_decode(lo, hi, FALSE, row);
+  tile_row_to_rgba(row, s_pal.color, out);
+}
+
+static void render_obj_row_decoder(u8 lo, u8 hi, Bool xflip, RGBA* out) {
+  u8 row[TILE_ROW_PIXELS];
+  tile_row_decode(lo, hi, xflip, row);
+  tile_row_to_rgba(row, s_pal.color, out);
+}
+
+static void init_vram(void) {
+  u32 state = s_random_seed;
+  size_t i;
+  for (i = 0; i < sizeof(s_tile_data); ++i) {
+    s_tile_data[i] = (u8)random_next(&state);
+  }
+  for (i = 0; i < ARRAY_SIZE(s_map); ++i) {
+    s_map[i] = random_next(&state) % TILE_COUNT;
+    s_xflip[i] = random_next(&state) & 1;
+  }
+}
+
+/* Renders one frame, with the map scrolled by frame tiles. Each
+ * implementation gets its own copy of the loop so the row function can be
+ * inlined. */
+#define DEFINE_RENDER_FRAME(name, RENDER_ROW)                              \
+  static void render_frame_##name(int frame) {                             \
+    int y, tx;                                                             \
+    for (y = 0; y < SCREEN_HEIGHT; ++y) {                                  \
+      int map_y = ((y >> 3) + frame) % MAP_SIZE;                           \
+      RGBA* out = &s_frame_buffer[y * SCREEN_WIDTH];                       \
+      for (tx = 0; tx < SCREEN_WIDTH / TILE_ROW_PIXELS; ++tx) {            \
+        int entry = map_y * MAP_SIZE + (tx + frame) % MAP_SIZE;            \
+        const u8* row =                                                    \
+            &s_tile_data[(s_map[entry] * TILE_HEIGHT + (y & 7)) *          \
+                         TILE_ROW_BYTES];                                  \
+        RENDER_ROW(row[0], row[1], s_xflip[entry],                         \
+                   out + tx * TILE_ROW_PIXELS);                            \
+      }                                                                    \
+    }                                                                      \
+  }
+
+DEFINE_RENDER_FRAME(bg_scalar, render_bg_row_scalar)
+DEFINE_RENDER_FRAME(bg_decoder, render_bg_row_decoder)
+DEFINE_RENDER_FRAME(obj_scalar, render_obj_row_scalar)
+DEFINE_RENDER_FRAME(obj_decoder, render_obj_row_decoder)
+
+typedef void (*RenderFrameFunc)(int frame);
+
+static f64 time_frames(RenderFrameFunc render_frame) {
+  f64 start_time = get_time_sec();
+  int frame;
+  for (frame = 0; frame < s_frames; ++frame) {
+    render_frame(frame);
+  }
+  return get_time_sec() - start_time;
+}
+
+/* Every scroll position is covered after MAP_SIZE frames. */
+static Bool frames_match(RenderFrameFunc scalar, RenderFrameFunc decoder) {
+  static RGBA s_expected[SCREEN_WIDTH * SCREEN_HEIGHT];
+  int frame;
+  for (frame = 0; frame < MAP_SIZE; ++frame) {
+    scalar(frame);
+    memcpy(s_expected, s_frame_buffer, sizeof(s_expected));
+    decoder(frame);
+    if (memcmp(s_expected, s_frame_buffer, sizeof(s_expected)) != 0) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+static Bool bench(const char* name, RenderFrameFunc scalar,
+                  RenderFrameFunc decoder) {
+  Bool match = frames_match(scalar, decoder);
+  f64 scalar_time = time_frames(scalar);
+  f64 decoder_time = time_frames(decoder);
+  f64 rows = (f64)s_frames * SCREEN_HEIGHT * (SCREEN_WIDTH / TILE_ROW_PIXELS);
+  printf("%-4s scalar: %.3fs (%.1f Mrows/s)  decoder: %.3fs (%.1f Mrows/s)  "
+         "%.2fx%s\n",
+         name, scalar_time, rows / scalar_time / 1e6, decoder_time,
+         rows / decoder_time / 1e6, scalar_time / decoder_time,
+         match ? "" : "  [MISMATCH]");
+  return match;
+}
+
+static void usage(int argc, char** argv) {
+  PRINT_ERROR(
+      "usage: %s [options]\n"
+      "  -h,--help          help\n"
+      "  -f,--frames N      number of frames to render per pass (default "
+      "2000)\n"
+      "  -s,--seed SEED     random seed used to generate VRAM\n",
+      argv[0]);
+}
+
+static void parse_options(int argc, char** argv) {
+  static const Option options[] = {
+    {'h', "help", 0},
+    {'f', "frames", 1},
+    {'s', "seed", 1},
+  };
+
+  struct OptionParser* parser = option_parser_new(
+      options, sizeof(options) / sizeof(options[0]), argc, argv);
+
+  int done = 0;
+  while (!done) {
+    OptionResult result = option_parser_next(parser);
+    switch (result.kind) {
+      case OPTION_RESULT_KIND_UNKNOWN:
+        PRINT_ERROR("ERROR: Unknown option: %s.\n\n", result.arg);
+        goto error;
+
+      case OPTION_RESULT_KIND_EXPECTED_VALUE:
+        PRINT_ERROR("ERROR: Option --%s requires a value.\n\n",
+                    result.option->long_name);
+        goto error;
+
+      case OPTION_RESULT_KIND_BAD_SHORT_OPTION:
+        PRINT_ERROR("ERROR: Short option -%c is too long: %s.\n\n",
+                    result.option->short_name, result.arg);
+        goto error;
+
+      case OPTION_RESULT_KIND_OPTION:
+        switch (result.option->short_name) {
+          case 'h':
+            goto error;
+
+          case 'f':
+            s_frames = atoi(result.value);
+            break;
+
+          case 's':
+            s_random_seed = atoi(result.value);
+            break;
+
+          default:
+            abort();
+        }
+        break;
+
+      case OPTION_RESULT_KIND_ARG:
+        PRINT_ERROR("ERROR: Unexpected argument: %s.\n\n", result.value);
+        goto error;
+
+      case OPTION_RESULT_KIND_DONE:
+        done = 1;
+        break;
+    }
+  }
+
+  option_parser_delete(parser);
+  return;
+
+error:
+  usage(argc, argv);
+  option_parser_delete(parser);
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  parse_options(argc, argv);
+  init_vram();
+
+#if TILE_DECODE_SSE2
+  printf("decoder: SSE2\n");
+#elif TILE_DECODE_NEON
+  printf("decoder: NEON\n");
+#else
+  printf("decoder: scalar\n");
+#endif
+
+  Bool bg_ok = bench("bg", render_frame_bg_scalar, render_frame_bg_decoder);
+  Bool obj_ok =
+      bench("obj", render_frame_obj_scalar, render_frame_obj_decoder);
+  return bg_ok && obj_ok ? 0 : 1;
+}
@@ -0,0 +1,103 @@
+#ifndef BINJGB_TILE_DECODE_H_
+#define BINJGB_TILE_DECODE_H_
+
+#include "common.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TILE_DECODE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TILE_DECODE_NEON 1
+#endif
+
+#define TILE_ROW_PIXELS 8
+
+/* The bit of each bitplane that holds each pixel, leftmost pixel first. */
+static const u8 s_tile_row_bit[2][TILE_ROW_PIXELS] = {
+    {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01},
+    {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80},
+};
+
+/* Expands one row of a 2bpp tile into 8 palette indices, leftmost pixel
+ * first. lo and hi are the two bitplanes; normally bit 7 is the leftmost
+ * pixel, but if flip is TRUE then bit 0 is. */
+static inline void tile_row_decode(u8 lo, u8 hi, Bool flip,
+                                   u8 out[TILE_ROW_PIXELS]) {
+#if TILE_DECODE_SSE2
+  __m128i mask = _mm_loadl_epi64((const __m128i*)s_tile_row_bit[flip != 0]);
+  __m128i lo_set = _mm_cmpeq_epi8(
+      _mm_and_si128(_mm_set1_epi8((char)lo), mask), mask);
+  __m128i hi_set = _mm_cmpeq_epi8(
+      _mm_and_si128(_mm_set1_epi8((char)hi), mask), mask);
+  __m128i index = _mm_or_si128(_mm_and_si128(lo_set, _mm_set1_epi8(1)),
+                               _mm_and_si128(hi_set, _mm_set1_epi8(2)));
+  _mm_storel_epi64((__m128i*)out, index);
+#elif TILE_DECODE_NEON
+  uint8x8_t mask = vld1_u8(s_tile_row_bit[flip != 0]);
+  uint8x8_t lo_set = vtst_u8(vdup_n_u8(lo), mask);
+  uint8x8_t hi_set = vtst_u8(vdup_n_u8(hi), mask);
+  vst1_u8(out, vorr_u8(vand_u8(lo_set, vdup_n_u8(1)),
+                       vand_u8(hi_set, vdup_n_u8(2))));
+#else
+  const u8* bit = s_tile_row_bit[flip != 0];
+  int i;
+  for (i = 0; i < TILE_ROW_PIXELS; ++i) {
+    out[i] = ((hi & bit[i]) ? 2 : 0) | ((lo & bit[i]) ? 1 : 0);
+  }
+#endif
+}
+
+/* Looks up the colors of 8 decoded palette indices. color must have 4
+ * entries, e.g. PaletteRGBA.color. */
+static inline void tile_row_to_rgba(const u8 index[TILE_ROW_PIXELS],
+                                    const RGBA* color,
+                                    RGBA out[TILE_ROW_PIXELS]) {
+#if TILE_DECODE_SSE2
+  /* SSE2 has no gather, so use the two bits of each index to select between
+   * the four colors instead. */
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+  const __m128i c0 = _mm_set1_epi32((int)color[0]);
+  const __m128i c01 = _mm_xor_si128(c0, _mm_set1_epi32((int)color[1]));
+  const __m128i c2 = _mm_set1_epi32((int)color[2]);
+  const __m128i c23 = _mm_xor_si128(c2, _mm_set1_epi32((int)color[3]));
+  __m128i index16 =
+      _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)index), zero);
+  __m128i lanes[2] = {_mm_unpacklo_epi16(index16, zero),
+                      _mm_unpackhi_epi16(index16, zero)};
+  int i;
+  for (i = 0; i < 2; ++i) {
+    __m128i lo_set = _mm_cmpeq_epi32(_mm_and_si128(lanes[i], one), one);
+    __m128i hi_set = _mm_cmpeq_epi32(_mm_and_si128(lanes[i], two), two);
+    __m128i even = _mm_xor_si128(c0, _mm_and_si128(lo_set, c01));
+    __m128i odd = _mm_xor_si128(c2, _mm_and_si128(lo_set, c23));
+    __m128i result = _mm_xor_si128(
+        even, _mm_and_si128(hi_set, _mm_xor_si128(even, odd)));
+    _mm_storeu_si128((__m128i*)(out + i * 4), result);
+  }
+#elif TILE_DECODE_NEON
+  const uint32x4_t one = vdupq_n_u32(1), two = vdupq_n_u32(2);
+  uint16x8_t index16 = vmovl_u8(vld1_u8(index));
+  uint32x4_t lanes[2] = {vmovl_u16(vget_low_u16(index16)),
+                         vmovl_u16(vget_high_u16(index16))};
+  int i;
+  for (i = 0; i < 2; ++i) {
+    uint32x4_t lo_set = vtstq_u32(lanes[i], one);
+    uint32x4_t hi_set = vtstq_u32(lanes[i], two);
+    uint32x4_t even = vbslq_u32(lo_set, vdupq_n_u32(color[1]),
+                                vdupq_n_u32(color[0]));
+    uint32x4_t odd = vbslq_u32(lo_set, vdupq_n_u32(color[3]),
+                               vdupq_n_u32(color[2]));
+    vst1q_u32(out + i * 4, vbslq_u32(hi_set, odd, even));
+  }
+#else
+  int i;
+  for (i = 0; i < TILE_ROW_PIXELS; ++i) {
+    out[i] = color[index[i]];
+  }
+#endif
+}
+
+#endif /* BINJGB_TILE_DECODE_H_ */